@@ -0,0 +1,249 @@
+/*
+ * bench.c
+ *
+ * Render and parse benchmarks for the terminal code, run on a PC.
+ *
+ *   ./bench              the built in workloads
+ *   ./bench file...      and time receive_char() over recorded sessions as well, e.g. from
+ *                        script -q -c "ls -lR /usr" ls.rec
+ *
+ * Times are host time, so only compare numbers from the same machine.  The check column is a
+ * hash of the screen afterwards; if it changes, so did what the terminal draws.
+ *
+ * (c) Massachusetts Institute of Technology 2010
+ * Permission granted for experimental and personal use;
+ * license for commercial sale available from MIT.
+ */
+
+#include "hardware.h"
+#include "video.h"
+#include "terminal.h"
+#include "Font6x8.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#define MIN_NSEC        500000000ull  /* run each benchmark for at least this long */
+#define WORKLOAD_SIZE   (1 << 20)     /* size of the generated sessions */
+
+typedef struct
+{
+  uint8_t *data;
+  size_t len;
+  size_t size;
+} workload_t;
+
+static workload_t *current;
+static uint32_t seed = 1;
+
+static uint32_t rnd(uint32_t n)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) % n;
+}
+
+static void emit(workload_t *w, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  if (w->size - w->len < 256)
+  {
+    w->size = w->size ? w->size * 2 : 4096;
+    w->data = realloc(w->data, w->size);
+    if (!w->data)
+    {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  va_start(ap, fmt);
+  n = vsnprintf((char *)w->data + w->len, w->size - w->len, fmt, ap);
+  va_end(ap);
+  w->len += n;
+}
+
+static uint32_t screen_hash(void)
+{
+  /* FNV-1a */
+  uint32_t h = 2166136261u;
+  size_t i;
+  for (i = 0; i < sizeof(tileMap); i++)
+    h = (h ^ ((uint8_t *)tileMap)[i]) * 16777619u;
+  return h;
+}
+
+/* Runs fn until MIN_NSEC has gone by and returns nanoseconds per call. */
+static double time_it(void (*fn)(void))
+{
+  uint64_t start = host_nsec();
+  uint64_t elapsed;
+  uint32_t calls = 0;
+
+  do
+  {
+    fn();
+    calls++;
+    elapsed = host_nsec() - start;
+  } while (elapsed < MIN_NSEC);
+
+  return (double)elapsed / calls;
+}
+
+static void report(const char *name, double value, const char *unit)
+{
+  printf("%-24s %12.2f %-8s check %08x\n", name, value, unit, screen_hash());
+}
+
+/***** Generated sessions *****/
+
+/* a long directory listing: plain text and scrolling */
+static void gen_ls(workload_t *w)
+{
+  static const char *ext[] = { "c", "h", "o", "txt", "png" };
+  uint32_t dir = 0;
+
+  while (w->len < WORKLOAD_SIZE)
+  {
+    uint32_t files = 5 + rnd(30);
+    emit(w, "\r\n./src/dir%u:\r\ntotal %u\r\n", dir++, files * 8);
+    while (files--)
+      emit(w, "-rw-r--r--  1 user  staff  %7u Oct %2u %02u:%02u file%04u.%s\r\n",
+          rnd(1000000), 1 + rnd(31), rnd(24), rnd(60), rnd(10000), ext[rnd(5)]);
+  }
+}
+
+/* scrolling through a file in vim: scroll region, a new line at the bottom, ruler update */
+static void gen_vim(workload_t *w)
+{
+  uint32_t line = 1;
+
+  emit(w, "\x1b[H\x1b[2J\x1b[1;23r");
+  while (w->len < WORKLOAD_SIZE)
+  {
+    uint32_t indent = rnd(4) * 2;
+    emit(w, "\x1b[23;1H\n");
+    emit(w, "%*s%s(arg%u, %u);  /* comment %u */\x1b[K", indent, "",
+        (rnd(2)) ? "video_putc" : "receive_char", rnd(10), rnd(1000), line);
+    emit(w, "\x1b[24;63H\x1b[7m%-8u1\x1b[m\x1b[23;%uH", line++, indent + 1);
+  }
+}
+
+/* top redrawing the whole screen in place */
+static void gen_top(workload_t *w)
+{
+  while (w->len < WORKLOAD_SIZE)
+  {
+    uint32_t i;
+    emit(w, "\x1b[H");
+    emit(w, "top - %02u:%02u:%02u up 3 days,  2 users,  load average: %u.%02u, %u.%02u\x1b[K\r\n",
+        rnd(24), rnd(60), rnd(60), rnd(4), rnd(100), rnd(4), rnd(100));
+    emit(w, "Tasks: %u total,   %u running\x1b[K\r\n", 100 + rnd(50), 1 + rnd(4));
+    emit(w, "Mem:  %uk total, %uk used\x1b[K\r\n\x1b[K\r\n", 2048000, rnd(2048000));
+    emit(w, "\x1b[7m  PID USER      PR  NI  VIRT  RES  SHR S %%CPU %%MEM    TIME+  COMMAND\x1b[m\x1b[K\r\n");
+    for (i = 0; i < 18; i++)
+      emit(w, "%5u user      20   0 %5u %4u %4u S %4u.%u %4u.%u %3u:%02u.%02u proc%u\x1b[K\r\n",
+          rnd(30000), rnd(99999), rnd(9999), rnd(9999), rnd(100), rnd(10), rnd(100), rnd(10),
+          rnd(100), rnd(60), rnd(100), i);
+    emit(w, "\x1b[J");
+  }
+}
+
+static workload_t *load_file(const char *name)
+{
+  workload_t *w = calloc(1, sizeof(*w));
+  FILE *f = fopen(name, "rb");
+  int c;
+
+  if (!f)
+  {
+    perror(name);
+    exit(1);
+  }
+  while ((c = getc(f)) != EOF)
+  {
+    if (w->len == w->size)
+    {
+      w->size = w->size ? w->size * 2 : 4096;
+      w->data = realloc(w->data, w->size);
+    }
+    w->data[w->len++] = c;
+  }
+  fclose(f);
+  return w;
+}
+
+/***** Benchmarks *****/
+
+static void bench_render(void)
+{
+  updateFrameBuffer(tileMap, Font6x8);
+}
+
+static void bench_scroll(void)
+{
+  video_lfwd();
+}
+
+static void bench_parse(void)
+{
+  size_t i;
+  for (i = 0; i < current->len; i++)
+    receive_char(current->data[i]);
+}
+
+static void run_parse(const char *name, workload_t *w)
+{
+  double ns;
+
+  current = w;
+  app_setup();
+  ns = time_it(bench_parse);
+  /* screen as the session leaves it, not wherever the last partial repeat got to */
+  app_setup();
+  bench_parse();
+  report(name, w->len * 1000.0 / ns, "MB/s");
+}
+
+int main(int argc, char **argv)
+{
+  static void (*const gens[])(workload_t *) = { gen_ls, gen_vim, gen_top };
+  static const char *const names[] = { "parse ls -lR", "parse vim scroll", "parse top" };
+  uint32_t i;
+  uint32_t x, y;
+
+  video_setup();
+  app_setup();
+
+  for (y = 0; y < TILES_HIGH; y++)
+    for (x = 0; x < TILES_WIDE; x++)
+      tileMap[y][x] = ' ' + (x + y) % 95;
+  report("render frame", time_it(bench_render) / 1000, "us");
+
+  app_setup();
+  video_gotoxy(0, video_rows()-1);
+  video_putsxy(0, video_rows()-1, "scroll");
+  report("scroll screen", time_it(bench_scroll), "ns");
+
+  for (i = 0; i < sizeof(gens)/sizeof(gens[0]); i++)
+  {
+    workload_t w = { NULL, 0, 0 };
+    seed = 1;
+    gens[i](&w);
+    run_parse(names[i], &w);
+    free(w.data);
+  }
+
+  for (i = 1; i < (uint32_t)argc; i++)
+  {
+    workload_t *w = load_file(argv[i]);
+    run_parse(argv[i], w);
+    free(w->data);
+    free(w);
+  }
+
+  return 0;
+}
@@ -0,0 +1,507 @@
+/*
+ * emulator.c
+ *
+ * The thinner client on a PC: the real terminal code (input.c, terminal.c, termconfig.c,
+ * video.c) with the serial port connected to a pty or stdin, the framebuffer shown in an
+ * SDL window, and host keystrokes fed through decode() as PS/2 scancodes.
+ *
+ *   ./emulator               run $SHELL on a pty, as if it were on the other end of the serial line
+ *   ./emulator cmd args...   run cmd instead
+ *   ./emulator -             read serial input from stdin and write what the terminal sends to stdout
+ *
+ * With -headless there is no window; the input is run through as fast as it comes, a frame is
+ * drawn every -rate bytes of it, and the frames are written out and timed instead of shown:
+ *   -pbm frame%05d.pbm       write frames as PBM images (convert with pnmtopng if need be)
+ *   -every N                 ...only every Nth frame
+ *   -hash                    print a hash of each frame on stdout, for comparing against a known good run
+ *   -rate N                  input bytes per frame, default 96 (57600 baud at 60 frames a second)
+ * "make headless" builds emulator-headless, which doesn't need SDL and only runs this way.
+ *
+ * (c) Massachusetts Institute of Technology 2010
+ * Permission granted for experimental and personal use;
+ * license for commercial sale available from MIT.
+ */
+
+#define _GNU_SOURCE
+
+#include "hardware.h"
+#include "thinnerclient.h"
+#include "video.h"
+#include "terminal.h"
+#include "keycodes.h"
+#include "Font6x8.h"
+
+#ifndef NO_SDL
+#include <SDL.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pty.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define SCALE         2     /* window pixels per framebuffer pixel */
+#define FRAME_MS      16    /* about 60 frames a second, like the TV */
+#define READ_CHUNK    128   /* less than the firmware's serial buffer, so nothing gets dropped */
+#define NUM_CODES     0x84  /* size of the scancode tables in input.c */
+#define DEFAULT_RATE  96    /* bytes per frame at 57600 baud */
+
+extern const char codetable[];
+extern const char codetable_extended[];
+
+static int serialfd = -1;   /* what the terminal reads from */
+static int txfd = -1;       /* where what it sends goes */
+static int ptyrows;
+
+/* headless options */
+static const char *pbm_pattern;
+static uint32_t every = 1;
+static int print_hash;
+static uint32_t rate = DEFAULT_RATE;
+
+static void serial_tx(uint8_t c)
+{
+  if (write(txfd, &c, 1) < 0 && errno != EAGAIN)
+    txfd = -1;
+}
+
+/* Start cmd (or a shell) on a pty, sized like the terminal. */
+static void start_pty(char **cmd)
+{
+  struct winsize ws;
+  pid_t pid;
+
+  memset(&ws, 0, sizeof(ws));
+  ws.ws_row = ptyrows = video_rows();
+  ws.ws_col = TILES_WIDE;
+
+  pid = forkpty(&serialfd, NULL, NULL, &ws);
+  if (pid < 0)
+  {
+    perror("forkpty");
+    exit(1);
+  }
+  if (pid == 0)
+  {
+    const char *shell = getenv("SHELL");
+    setenv("TERM", "vt100", 1);
+    if (cmd[0])
+      execvp(cmd[0], cmd);
+    else
+      execl(shell ? shell : "/bin/sh", shell ? shell : "/bin/sh", (char *)NULL);
+    perror("exec");
+    _exit(1);
+  }
+  txfd = serialfd;
+}
+
+#ifndef NO_SDL
+/***** Serial port, for the window: a frame's worth of whatever has arrived *****/
+
+/* The status line takes a row from the terminal; tell the program on the pty. */
+static void resize_pty(void)
+{
+  struct winsize ws;
+
+  if (txfd != serialfd || video_rows() == ptyrows)
+    return;
+  memset(&ws, 0, sizeof(ws));
+  ws.ws_row = ptyrows = video_rows();
+  ws.ws_col = TILES_WIDE;
+  ioctl(serialfd, TIOCSWINSZ, &ws);
+}
+
+/* Move whatever has arrived into the serial buffer, the way USART1_IRQHandler does, and let the
+ * terminal at it.  Returns 0 once there's nothing left to read from. */
+static int serial_rx(void)
+{
+  uint8_t chunk[READ_CHUNK];
+  uint64_t start = host_nsec();
+  ssize_t n, i;
+
+  if (serialfd < 0)
+    return 1;
+
+  /* leave some of the frame for drawing */
+  while (host_nsec() - start < FRAME_MS/2 * 1000000ull)
+  {
+    n = read(serialfd, chunk, sizeof(chunk));
+    if (n == 0 || (n < 0 && errno != EAGAIN))
+    {
+      serialfd = -1;
+      return 0;
+    }
+    if (n < 0)
+      break;
+
+    for (i = 0; i < n; i++)
+      buf_enqueue(chunk[i]);
+    while (bufhead != buftail)
+      receive_char(buf_dequeue());
+  }
+  return 1;
+}
+
+/***** Keyboard *****/
+
+/* Set 2 scancode for an SDL key, looked up backwards in the firmware's own tables so the two
+ * can't disagree.  Returns 0 for keys the firmware doesn't know. */
+static uint8_t scancode_for(SDLKey sym, uint8_t *ext)
+{
+  char key = 0;
+  const char *table = codetable;
+  uint8_t i;
+
+  *ext = 0;
+  switch (sym)
+  {
+    case SDLK_LSHIFT:    return 0x12;
+    case SDLK_RSHIFT:    return 0x59;
+    case SDLK_LCTRL:     return 0x14;
+    case SDLK_RCTRL:     *ext = 1; return 0x14;
+    case SDLK_CAPSLOCK:  key = K_CAPSLK; break;
+    case SDLK_NUMLOCK:   key = K_NUMLK; break;
+    case SDLK_SCROLLOCK: key = K_SCRLK; break;
+    case SDLK_RETURN:    key = '\n'; break;
+    case SDLK_KP_ENTER:  key = '\n'; table = codetable_extended; break;
+    case SDLK_UP:        key = K_UP; table = codetable_extended; break;
+    case SDLK_DOWN:      key = K_DOWN; table = codetable_extended; break;
+    case SDLK_LEFT:      key = K_LEFT; table = codetable_extended; break;
+    case SDLK_RIGHT:     key = K_RIGHT; table = codetable_extended; break;
+    case SDLK_INSERT:    key = K_INS; table = codetable_extended; break;
+    case SDLK_DELETE:    key = K_DEL; table = codetable_extended; break;
+    case SDLK_HOME:      key = K_HOME; table = codetable_extended; break;
+    case SDLK_END:       key = K_END; table = codetable_extended; break;
+    case SDLK_PAGEUP:    key = K_PGUP; table = codetable_extended; break;
+    case SDLK_PAGEDOWN:  key = K_PGDN; table = codetable_extended; break;
+    default:
+      if (sym >= SDLK_F1 && sym <= SDLK_F12)
+        key = K_F1 + (sym - SDLK_F1);
+      else if (sym > 0 && sym < 0x7F)
+        key = sym;  /* SDL's keysyms for these are their unshifted ASCII */
+      break;
+  }
+
+  if (!key)
+    return 0;
+  for (i = 1; i < NUM_CODES; i++)
+    if (table[i] == key)
+    {
+      *ext = (table == codetable_extended);
+      return i;
+    }
+  return 0;
+}
+
+static void send_scancode(SDLKey sym, uint8_t release)
+{
+  uint8_t ext;
+  uint8_t code = scancode_for(sym, &ext);
+
+  if (!code)
+    return;
+  if (ext)
+    decode(0xE0);
+  if (release)
+    decode(0xF0);
+  decode(code);
+}
+
+/* Repeat held keys at whatever rate the terminal told the keyboard to use. */
+static void update_typematic(void)
+{
+  static int16_t current = -1;
+  uint32_t delay, period;
+
+  if (current == host_typematic)
+    return;
+  current = host_typematic;
+
+  /* PS/2 typematic byte: bits 5-6 delay in 250ms steps, bits 0-4 rate as (8+A)*2^B*4.17ms */
+  delay = 250 * (1 + ((current >> 5) & 3));
+  period = ((8 + (current & 7)) << ((current >> 3) & 3)) * 417 / 100;
+  SDL_EnableKeyRepeat(delay, period);
+}
+
+static void update_caption(void)
+{
+  static int16_t current = -1;
+  char caption[64];
+
+  if (current == host_leds)
+    return;
+  current = host_leds;
+
+  snprintf(caption, sizeof(caption), "thinner client%s%s%s",
+      (current & PS2_LED_CAPS) ? "  [caps]" : "",
+      (current & PS2_LED_NUM) ? "  [num]" : "",
+      (current & PS2_LED_SCROLL) ? "  [scroll]" : "");
+  SDL_WM_SetCaption(caption, NULL);
+}
+
+/***** Display *****/
+
+static void draw(SDL_Surface *screen)
+{
+  const Uint32 white = SDL_MapRGB(screen->format, 255, 255, 255);
+  const Uint32 black = SDL_MapRGB(screen->format, 0, 0, 0);
+  uint16_t x, y;
+  uint8_t i, j;
+
+  if (SDL_MUSTLOCK(screen) && SDL_LockSurface(screen) < 0)
+    return;
+
+  for (y = 0; y < BUFFER_VERT_SIZE; y++)
+  {
+    for (x = 0; x < (BUFFER_LINE_LENGTH-1)*16; x++)
+    {
+      /* SPI shifts each halfword out MSB first */
+      Uint32 colour = (frameBuffer[y][x >> 4] & (0x8000 >> (x & 15))) ? white : black;
+      for (j = 0; j < SCALE; j++)
+      {
+        Uint32 *row = (Uint32 *)((uint8_t *)screen->pixels + (y*SCALE + j) * screen->pitch);
+        for (i = 0; i < SCALE; i++)
+          row[x*SCALE + i] = colour;
+      }
+    }
+  }
+
+  if (SDL_MUSTLOCK(screen))
+    SDL_UnlockSurface(screen);
+  SDL_Flip(screen);
+}
+
+static int run_window(void)
+{
+  SDL_Surface *screen;
+  SDL_Event event;
+  int running = 1;
+
+  fcntl(serialfd, F_SETFL, fcntl(serialfd, F_GETFL) | O_NONBLOCK);
+
+  if (SDL_Init(SDL_INIT_VIDEO) < 0)
+  {
+    fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
+    return 1;
+  }
+  screen = SDL_SetVideoMode((BUFFER_LINE_LENGTH-1)*16*SCALE, BUFFER_VERT_SIZE*SCALE, 32, SDL_SWSURFACE);
+  if (!screen)
+  {
+    fprintf(stderr, "SDL_SetVideoMode: %s\n", SDL_GetError());
+    SDL_Quit();
+    return 1;
+  }
+
+  while (running)
+  {
+    uint32_t start = SDL_GetTicks();
+    uint32_t spent;
+
+    while (SDL_PollEvent(&event))
+    {
+      switch (event.type)
+      {
+        case SDL_QUIT:
+          running = 0;
+          break;
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+          /* SDL 1.2 sends caps lock as down when it locks and up when it unlocks, so press it both times */
+          if (event.key.keysym.sym == SDLK_CAPSLOCK)
+          {
+            send_scancode(SDLK_CAPSLOCK, 0);
+            send_scancode(SDLK_CAPSLOCK, 1);
+          }
+          else
+            send_scancode(event.key.keysym.sym, event.type == SDL_KEYUP);
+          break;
+      }
+    }
+
+    /* the main loop from main.c */
+    if (!serial_rx() && txfd != 1)
+      running = 0;  /* program on the pty has exited */
+    while (key_buf_size())
+      app_handle_key(buffer_get_key());
+    updateFrameBuffer(tileMap, Font6x8);
+
+    resize_pty();
+    update_typematic();
+    update_caption();
+    draw(screen);
+
+    spent = SDL_GetTicks() - start;
+    if (spent < FRAME_MS)
+      SDL_Delay(FRAME_MS - spent);
+  }
+
+  SDL_Quit();
+  return 0;
+}
+#endif
+
+/***** Headless *****/
+
+/* The framebuffer as the TV gets it: 480 pixels a row, MSB first, which is also PBM's raw layout. */
+static void frame_bytes(uint8_t *out)
+{
+  uint16_t x, y;
+  for (y = 0; y < BUFFER_VERT_SIZE; y++)
+    for (x = 0; x < BUFFER_LINE_LENGTH-1; x++)
+    {
+      *out++ = frameBuffer[y][x] >> 8;
+      *out++ = frameBuffer[y][x];
+    }
+}
+
+static void emit_frame(uint32_t frame)
+{
+  static uint8_t bytes[BUFFER_VERT_SIZE * (BUFFER_LINE_LENGTH-1) * 2];
+  uint32_t hash = 2166136261u;
+  size_t i;
+
+  frame_bytes(bytes);
+
+  if (print_hash)
+  {
+    /* FNV-1a */
+    for (i = 0; i < sizeof(bytes); i++)
+      hash = (hash ^ bytes[i]) * 16777619u;
+    printf("%u %08x\n", frame, hash);
+  }
+
+  if (pbm_pattern && frame % every == 0)
+  {
+    char name[256];
+    FILE *f;
+    snprintf(name, sizeof(name), pbm_pattern, frame);
+    f = fopen(name, "wb");
+    if (!f)
+    {
+      perror(name);
+      exit(1);
+    }
+    fprintf(f, "P4\n%u %u\n", (BUFFER_LINE_LENGTH-1)*16, BUFFER_VERT_SIZE);
+    fwrite(bytes, 1, sizeof(bytes), f);
+    fclose(f);
+  }
+}
+
+static int run_headless(void)
+{
+  uint8_t chunk[READ_CHUNK];
+  uint64_t start = host_nsec();
+  uint64_t parse = 0, render = 0, t, elapsed;
+  uint64_t bytes = 0;
+  uint32_t frames = 0, inframe = 0;
+  ssize_t n, i;
+
+  /* nobody is there to answer the terminal */
+  if (txfd == 1)
+    txfd = -1;
+
+  for (;;)
+  {
+    n = read(serialfd, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    for (i = 0; i < n; i++)
+    {
+      buf_enqueue(chunk[i]);
+      if (++inframe < rate && buf_size() < READ_CHUNK)
+        continue;
+
+      t = host_nsec();
+      while (bufhead != buftail)
+        receive_char(buf_dequeue());
+      while (key_buf_size())
+        app_handle_key(buffer_get_key());
+      parse += host_nsec() - t;
+
+      if (inframe < rate)
+        continue;
+      inframe = 0;
+
+      t = host_nsec();
+      updateFrameBuffer(tileMap, Font6x8);
+      render += host_nsec() - t;
+      emit_frame(frames++);
+    }
+    bytes += (n > 0) ? n : 0;
+
+    /* end of the input (or the program on the pty went away): show whatever is left over */
+    if (n <= 0)
+    {
+      if (inframe)
+      {
+        while (bufhead != buftail)
+          receive_char(buf_dequeue());
+        updateFrameBuffer(tileMap, Font6x8);
+        emit_frame(frames++);
+      }
+      break;
+    }
+  }
+
+  elapsed = host_nsec() - start;
+  if (!frames || !elapsed)
+    return 0;
+  fprintf(stderr, "%u frames in %.3f s: %.1f frames/s, %.0f bytes/s, parse %.2f us/frame, render %.2f us/frame\n",
+      frames, elapsed / 1e9, frames * 1e9 / elapsed, bytes * 1e9 / elapsed,
+      parse / 1e3 / frames, render / 1e3 / frames);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int headless = 0;
+  int arg = 1;
+
+  for (; arg < argc && argv[arg][0] == '-' && argv[arg][1]; arg++)
+  {
+    if (!strcmp(argv[arg], "-headless"))
+      headless = 1;
+    else if (!strcmp(argv[arg], "-hash"))
+      print_hash = 1;
+    else if (!strcmp(argv[arg], "-pbm") && arg+1 < argc)
+      pbm_pattern = argv[++arg];
+    else if (!strcmp(argv[arg], "-every") && arg+1 < argc)
+      every = strtoul(argv[++arg], NULL, 0);
+    else if (!strcmp(argv[arg], "-rate") && arg+1 < argc)
+      rate = strtoul(argv[++arg], NULL, 0);
+    else
+    {
+      fprintf(stderr, "usage: %s [-headless [-pbm pattern] [-every N] [-hash] [-rate N]] [- | command...]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (!every) every = 1;
+  if (!rate) rate = 1;
+
+  video_setup();
+  app_setup();
+  host_tx = serial_tx;
+
+  if (arg < argc && !strcmp(argv[arg], "-"))
+  {
+    serialfd = 0;
+    txfd = 1;
+  }
+  else
+    start_pty(argv + arg);
+
+#ifdef NO_SDL
+  headless = 1;
+#endif
+  if (headless)
+    return run_headless();
+#ifndef NO_SDL
+  return run_window();
+#endif
+}
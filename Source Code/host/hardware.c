@@ -0,0 +1,77 @@
+/*
+ * hardware.c
+ *
+ * Host stand-ins for the parts of thinnerclient.c the terminal code uses
+ *
+ * (c) Massachusetts Institute of Technology 2010
+ * Permission granted for experimental and personal use;
+ * license for commercial sale available from MIT.
+ */
+
+#include "hardware.h"
+#include "thinnerclient.h"
+
+#include <stdint.h>
+#include <time.h>
+
+uint16_t frameBuffer[BUFFER_VERT_SIZE][BUFFER_LINE_LENGTH];
+USART_InitTypeDef USART_InitStructure;
+
+USART_TypeDef host_usart1;
+CoreDebug_Type host_coredebug;
+
+void (*host_tx)(uint8_t c);
+uint32_t host_baudrate;
+uint8_t host_leds;
+uint8_t host_typematic = PS2_TYPEMATIC_DEFAULT;
+
+uint64_t host_nsec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+DWT_Type *host_dwt(void)
+{
+  static DWT_Type dwt;
+  dwt.CYCCNT = host_nsec() * CPU_MHZ / 1000;
+  return &dwt;
+}
+
+/***** USART *****/
+
+void USART_Init(USART_TypeDef* USARTx, USART_InitTypeDef* USART_InitStruct)
+{
+  (void)USARTx;
+  host_baudrate = USART_InitStruct->USART_BaudRate;
+}
+
+void USART_SendData(USART_TypeDef* USARTx, uint16_t Data)
+{
+  (void)USARTx;
+  if (host_tx)
+    host_tx(Data);
+}
+
+FlagStatus USART_GetFlagStatus(USART_TypeDef* USARTx, uint16_t USART_FLAG)
+{
+  (void)USARTx;
+  (void)USART_FLAG;
+  return SET;
+}
+
+/***** Keyboard *****/
+
+void ps2_set_typematic(uint8_t typematic)
+{
+  host_typematic = typematic;
+}
+
+void ps2_set_led(uint8_t led, uint8_t on)
+{
+  if (on)
+    host_leds |= led;
+  else
+    host_leds &= ~led;
+}
@@ -0,0 +1,29 @@
+/*
+ * hardware.h
+ *
+ * Host stand-ins for the parts of thinnerclient.c the terminal code uses
+ *
+ * (c) Massachusetts Institute of Technology 2010
+ * Permission granted for experimental and personal use;
+ * license for commercial sale available from MIT.
+ */
+
+#ifndef _HARDWARE_H_
+#define _HARDWARE_H_
+
+#include <stdint.h>
+
+/* Called with every byte the terminal sends out of USART1.  NULL throws them away. */
+extern void (*host_tx)(uint8_t c);
+
+/* What uart_update() last set the port to. */
+extern uint32_t host_baudrate;
+
+/* What the terminal last asked the keyboard for. */
+extern uint8_t host_leds;
+extern uint8_t host_typematic;
+
+/* Host clock in nanoseconds. */
+uint64_t host_nsec(void);
+
+#endif
@@ -0,0 +1,578 @@
+/*
+ * ntscsim.c
+ *
+ * Scanline timing simulator for the video interrupt, run on a PC.
+ *
+ * The picture is only as steady as the moment TIM2_IRQHandler gets to DMA_Cmd(): SPI1 starts
+ * shifting a line out as soon as its DMA is enabled, so anything that holds the handler up moves
+ * that line sideways on the TV.  This steps through TIM2's compare events, the NVIC and the other
+ * handlers event by event, works out where every line's pixels land, and reports how far they
+ * moved, so priority and handler length changes can be tried here before flashing.
+ *
+ *   ./ntscsim                    the firmware as it is, with the serial port running flat out
+ *   ./ntscsim -group 2           ...with NVIC_PriorityGroupConfig(NVIC_PriorityGroup_2) in NVIC_Config()
+ *   ./ntscsim -pgm tv.pgm        and write the worst field out as the TV would show it
+ *
+ *   -frames N            fields to simulate (60)
+ *   -group reset|0..4    NVIC priority grouping.  reset is what the firmware runs with now: it never calls
+ *                        NVIC_PriorityGroupConfig(), and NVIC_Init() then works every priority out to 0, so
+ *                        nothing preempts anything and the video interrupt waits for whatever is running.
+ *   -prio isr pre sub    priorities for video, usart or keyboard, as given to NVIC_Init() (0 0, 1 0, 2 0)
+ *   -dur isr min max     how long a handler runs, in cycles; each run picks a time between the two
+ *   -profile file        take the handler run times from an ESC [ 200 n report (see profile.h)
+ *   -dma N               cycles from the start of TIM2_IRQHandler to its DMA_Cmd()
+ *   -baud N              serial rate (57600)
+ *   -rx N                percent of byte times that bring a byte (100)
+ *   -keys N              keyboard scancodes a second (20)
+ *   -exti                keyboard on the pin change interrupt, one per clock edge (PS2_CAPTURE_DMA undefined)
+ *   -seed N
+ *
+ * The built in handler times are estimates; the numbers from a -profile report off a real board are better.
+ *
+ * (c) Massachusetts Institute of Technology 2010
+ * Permission granted for experimental and personal use;
+ * license for commercial sale available from MIT.
+ */
+
+#include "thinnerclient.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_CYCLES       (TIMER_PERIOD+1)            /* TIM2 runs off the core clock, unprescaled */
+#define LINES_PER_FIELD   262
+#define SPI_PRESCALER     8                           /* SPI_BaudRatePrescaler_8: a pixel every 8 cycles */
+#define LINE_PIXELS       (BUFFER_LINE_LENGTH*16)
+#define ENTRY_CYCLES      12                          /* Cortex-M3 exception entry, stacking and vector fetch */
+#define TAILCHAIN_CYCLES  6                           /* ...or going straight from one handler to the next */
+#define PS2_EDGE_CYCLES   (80*CPU_MHZ)                /* 12.5kHz keyboard clock */
+
+/* the TV picture: one pixel per SPI bit time, and a field that lost lines runs long */
+#define IMG_WIDTH         (LINE_CYCLES/SPI_PRESCALER)
+#define IMG_LINES         300
+#define LEVEL_SYNC        0
+#define LEVEL_BLACK       60
+#define LEVEL_WHITE       255
+
+enum
+{
+  SRC_VIDEO,
+  SRC_USART,
+  SRC_KEYBOARD,
+  NUM_SRCS
+};
+
+typedef struct
+{
+  const char *name;
+  uint8_t irqn;           /* position in the vector table, which settles ties */
+  uint8_t pre, sub;       /* as given to NVIC_Init() */
+  uint32_t durmin, durmax;
+
+  uint8_t ip;             /* what NVIC_Init() puts in the priority register */
+  uint64_t next;          /* when the peripheral next asks for an interrupt */
+  uint64_t pended;
+  int pending;
+  uint8_t burst;          /* pin change keyboard: edges left in this scancode */
+
+  uint32_t count, lost;
+  uint32_t latmin, latmax;
+  uint64_t lattotal;
+} source_t;
+
+typedef struct
+{
+  source_t *src;
+  uint32_t left;          /* cycles of entry and handler still to run */
+  int32_t until_dma;      /* video only: cycles until DMA_Cmd(), or -1 once it's done */
+} active_t;
+
+static source_t sources[NUM_SRCS] = {
+  { .name = "video",    .irqn = 28, .pre = 0, .durmin = 300, .durmax = 400 },   /* TIM2_IRQn */
+  { .name = "usart",    .irqn = 37, .pre = 1, .durmin = 250, .durmax = 350 },   /* USART1_IRQn */
+  { .name = "keyboard", .irqn = 12, .pre = 2, .durmin = 400, .durmax = 1200 },  /* DMA1_Channel2_IRQn */
+};
+
+static uint32_t aircr = 0;              /* PRIGROUP is 0 out of reset */
+static uint32_t dma_at = 150;
+static uint32_t baud = 57600;
+static uint32_t rx_percent = 100;
+static uint32_t keys_per_sec = 20;
+static int exti;
+static uint32_t seed = 1;
+
+static uint64_t now;
+static active_t stack[NUM_SRCS];
+static int depth;
+static int tailchain;
+
+/* firmware state */
+static uint16_t lineCount;
+static uint16_t ccr2_shadow = 342, ccr2 = 342;
+
+/* the line being shifted out */
+static int dma_running;
+static uint64_t dma_start;
+static uint16_t dma_row;
+
+/* the field being drawn, and the worst one so far */
+static uint8_t img[IMG_LINES][IMG_WIDTH];
+static uint8_t worst_img[IMG_LINES][IMG_WIDTH];
+static uint64_t field_first;            /* line number of the field's first line */
+static int32_t field_jitter;
+static int32_t worst_jitter = -1;
+static uint32_t worst_field, worst_lines;
+static uint32_t fields;
+
+/* jitter statistics */
+#define JITTER_BINS 8
+static const char *jitter_labels[JITTER_BINS] = { "0", "1", "2", "3", "4-7", "8-15", "16-31", "32+" };
+static uint32_t jitter_hist[JITTER_BINS];
+static int32_t jitter_min = INT32_MAX, jitter_max = INT32_MIN;
+static int64_t jitter_total;
+static uint32_t dma_lines, spill_lines;
+
+static uint32_t rnd(void)
+{
+  /* xorshift, plenty for picking handler times */
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static uint32_t pick(uint32_t lo, uint32_t hi)
+{
+  return lo + rnd() % (hi - lo + 1);
+}
+
+static uint64_t exponential(double mean)
+{
+  return 1 + (uint64_t)(-log((rnd() + 1.0) / 4294967297.0) * mean);
+}
+
+static uint8_t nvic_ip(uint8_t pre, uint8_t sub)
+{
+  /* NVIC_Init() from misc.c, including what its shift does on the chip with PRIGROUP left at 0:
+   * tmppre wraps around and an LSL by 32 or more gives 0, so the preemption priority is lost */
+  uint32_t tmppriority = (0x700 - (aircr & 0x700)) >> 8;
+  uint32_t tmppre = 4 - tmppriority;
+  uint32_t tmpsub = 0x0F >> tmppriority;
+  uint32_t ip = (tmppre < 32) ? (uint32_t)pre << tmppre : 0;
+
+  ip |= sub & tmpsub;
+  return ip << 4;
+}
+
+/* Only this part of the priority decides preemption, the rest just orders pending interrupts. */
+static uint8_t group_priority(const source_t *s)
+{
+  return s->ip >> (((aircr >> 8) & 7) + 1);
+}
+
+/***** The TV picture *****/
+
+static void draw_dma(uint64_t until)
+{
+  uint64_t t;
+  uint32_t p, i;
+  uint16_t bits = 0;
+
+  if (!dma_running)
+    return;
+
+  /* a test card: the margin dark, a bar every 16 pixels and a line every 16 rows */
+  for (p = 0; p < LINE_PIXELS; p++)
+  {
+    t = dma_start + (uint64_t)p * SPI_PRESCALER;
+    if (t >= until)
+      break;
+    i = p / 16;
+    if (!(p % 16))
+      bits = (i < LEFT_MARGIN) ? 0 : ((dma_row % 16) ? 0x8000 : 0xFFFF);
+    if (t / LINE_CYCLES - field_first < IMG_LINES)
+      img[t / LINE_CYCLES - field_first][(t % LINE_CYCLES) / SPI_PRESCALER] = (bits & 0x8000) ? LEVEL_WHITE : LEVEL_BLACK;
+    bits <<= 1;
+  }
+  dma_running = 0;
+}
+
+static void start_line(uint64_t line)
+{
+  uint64_t row = line - field_first;
+
+  /* the compare 2 preload takes effect at the update event */
+  ccr2 = ccr2_shadow;
+  if (row < IMG_LINES)
+  {
+    memset(img[row], LEVEL_BLACK, IMG_WIDTH);
+    memset(img[row], LEVEL_SYNC, ccr2 / SPI_PRESCALER);
+  }
+}
+
+static void end_field(uint64_t line)
+{
+  draw_dma(now);
+  if (field_jitter > worst_jitter)
+  {
+    worst_jitter = field_jitter;
+    worst_field = fields;
+    worst_lines = (line + 1 - field_first < IMG_LINES) ? line + 1 - field_first : IMG_LINES;
+    memcpy(worst_img, img, sizeof(img));
+  }
+  fields++;
+  field_first = line + 1;
+  field_jitter = 0;
+  memset(img, LEVEL_BLACK, sizeof(img));
+}
+
+/* What TIM2_IRQHandler does, at the moment it reaches DMA_Cmd(). */
+static void video_dma(void)
+{
+  uint64_t line = now / LINE_CYCLES;
+  int32_t jitter = (int32_t)(now % LINE_CYCLES) - (INTERRUPT_DELAY + ENTRY_CYCLES + dma_at);
+  uint32_t px = (jitter > 0) ? jitter / SPI_PRESCALER : 0;
+  uint8_t bin;
+
+  lineCount++;
+
+  if (lineCount < BUFFER_VERT_SIZE)
+  {
+    /* DMA_DeInit() stops whatever was still going */
+    draw_dma(now);
+    dma_running = 1;
+    dma_start = now;
+    dma_row = lineCount;
+
+    for (bin = 0; bin < JITTER_BINS-1 && px >= (bin < 3 ? bin+1u : 4u << (bin-3)); bin++)
+      ;
+    jitter_hist[bin]++;
+    jitter_total += jitter;
+    if (jitter < jitter_min) jitter_min = jitter;
+    if (jitter > jitter_max) jitter_max = jitter;
+    if (jitter > field_jitter) field_jitter = jitter;
+    if (now % LINE_CYCLES + LINE_PIXELS * SPI_PRESCALER > LINE_CYCLES)
+      spill_lines++;
+    dma_lines++;
+  }
+
+  if (lineCount == 242)
+    ccr2_shadow = 4575-342;
+  if (lineCount == 261)
+    ccr2_shadow = 511;
+  if (lineCount == 262)
+  {
+    ccr2_shadow = 342;
+    lineCount = 0;
+    end_field(line);
+  }
+}
+
+/***** Interrupts *****/
+
+static void pend(source_t *s)
+{
+  if (s->pending)
+  {
+    s->lost++;
+    return;
+  }
+  s->pending = 1;
+  s->pended = now;
+}
+
+static void next_request(source_t *s)
+{
+  switch (s - sources)
+  {
+  case SRC_VIDEO:
+    s->next = (now / LINE_CYCLES + 1) * LINE_CYCLES + INTERRUPT_DELAY;
+    break;
+  case SRC_USART:
+    s->next = now + (uint64_t)CPU_MHZ * 1000000 * 10 / baud;
+    break;
+  case SRC_KEYBOARD:
+    if (exti && s->burst)
+      s->next = now + PS2_EDGE_CYCLES;
+    else
+      s->next = now + (keys_per_sec ? exponential((double)CPU_MHZ * 1000000 / keys_per_sec) : UINT64_MAX / 2);
+    break;
+  }
+}
+
+static void request(source_t *s)
+{
+  switch (s - sources)
+  {
+  case SRC_USART:
+    if (rnd() % 100 < rx_percent)
+      pend(s);
+    break;
+  case SRC_KEYBOARD:
+    if (exti)
+      s->burst = s->burst ? s->burst-1 : PS2_FRAME_BITS-1;
+    pend(s);
+    break;
+  default:
+    pend(s);
+    break;
+  }
+  next_request(s);
+}
+
+/* Take the most urgent pending interrupt, if it gets to preempt what's running. */
+static void take(void)
+{
+  source_t *best = NULL;
+  active_t *a;
+  uint32_t entry, lat;
+  int i;
+
+  for (i = 0; i < NUM_SRCS; i++)
+  {
+    source_t *s = &sources[i];
+    if (s->pending && (!best || s->ip < best->ip || (s->ip == best->ip && s->irqn < best->irqn)))
+      best = s;
+  }
+  if (!best || (depth && group_priority(best) >= group_priority(stack[depth-1].src)))
+    return;
+
+  entry = (tailchain && !depth) ? TAILCHAIN_CYCLES : ENTRY_CYCLES;
+  a = &stack[depth++];
+  a->src = best;
+  a->left = entry + pick(best->durmin, best->durmax);
+  a->until_dma = (best == &sources[SRC_VIDEO]) ? (int32_t)(entry + dma_at) : -1;
+  if (a->until_dma > (int32_t)a->left)
+    a->left = a->until_dma;
+
+  lat = now + entry - best->pended;
+  best->pending = 0;
+  best->count++;
+  best->lattotal += lat;
+  if (lat < best->latmin) best->latmin = lat;
+  if (lat > best->latmax) best->latmax = lat;
+}
+
+static void simulate(uint32_t frames)
+{
+  uint64_t end = (uint64_t)frames * LINES_PER_FIELD * LINE_CYCLES;
+  uint64_t next_line = 0, t;
+  active_t *a;
+  int i;
+
+  for (i = 0; i < NUM_SRCS; i++)
+  {
+    sources[i].ip = nvic_ip(sources[i].pre, sources[i].sub);
+    sources[i].latmin = UINT32_MAX;
+    next_request(&sources[i]);
+  }
+  sources[SRC_VIDEO].next = INTERRUPT_DELAY;
+
+  while (now < end)
+  {
+    /* on to whatever happens next */
+    t = next_line;
+    for (i = 0; i < NUM_SRCS; i++)
+      if (sources[i].next < t)
+        t = sources[i].next;
+    a = depth ? &stack[depth-1] : NULL;
+    if (a && now + a->left < t)
+      t = now + a->left;
+    if (a && a->until_dma >= 0 && now + a->until_dma < t)
+      t = now + a->until_dma;
+
+    if (a)
+    {
+      a->left -= t - now;
+      if (a->until_dma >= 0)
+        a->until_dma -= t - now;
+    }
+    now = t;
+    tailchain = 0;
+
+    if (a && a->until_dma == 0)
+    {
+      video_dma();
+      a->until_dma = -1;
+    }
+    if (a && !a->left)
+    {
+      depth--;
+      tailchain = 1;
+    }
+
+    if (now == next_line)
+    {
+      start_line(now / LINE_CYCLES);
+      next_line += LINE_CYCLES;
+    }
+    for (i = 0; i < NUM_SRCS; i++)
+      if (sources[i].next == now)
+        request(&sources[i]);
+
+    take();
+  }
+}
+
+/***** Setup and report *****/
+
+static source_t *find_source(const char *name)
+{
+  int i;
+  for (i = 0; i < NUM_SRCS; i++)
+    if (!strcmp(name, sources[i].name))
+      return &sources[i];
+  fprintf(stderr, "no handler called %s (video, usart or keyboard)\n", name);
+  exit(1);
+}
+
+/* Pull the durmin and durmax columns out of a profile_report(). */
+static void load_profile(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  char line[256], name[16];
+  unsigned count, durmin, durmax;
+  int i;
+
+  if (!f)
+  {
+    perror(path);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), f))
+  {
+    if (sscanf(line, "%15s %u %u %u", name, &count, &durmin, &durmax) != 4 || !count)
+      continue;
+    for (i = 0; i < NUM_SRCS; i++)
+      if (!strcmp(name, sources[i].name))
+      {
+        sources[i].durmin = durmin;
+        sources[i].durmax = durmax;
+      }
+  }
+  fclose(f);
+}
+
+static void write_pgm(const char *path)
+{
+  FILE *f = fopen(path, "wb");
+
+  if (!f)
+  {
+    perror(path);
+    exit(1);
+  }
+  fprintf(f, "P5\n%d %u\n255\n", IMG_WIDTH, worst_lines);
+  fwrite(worst_img, IMG_WIDTH, worst_lines, f);
+  fclose(f);
+}
+
+static void report(void)
+{
+  int i;
+
+  printf("isr      prio  count latmin latmax latavg durmin durmax lost\n");
+  for (i = 0; i < NUM_SRCS; i++)
+  {
+    source_t *s = &sources[i];
+    printf("%-8s 0x%02X %6u %6u %6u %6u %6u %6u %4u\n", s->name, s->ip, s->count,
+           s->count ? s->latmin : 0, s->latmax, s->count ? (unsigned)(s->lattotal / s->count) : 0,
+           s->durmin, s->durmax, s->lost);
+  }
+
+  printf("\nfields %u, DMA started on %u lines, nominally %u cycles into the line\n",
+         fields, dma_lines, INTERRUPT_DELAY + ENTRY_CYCLES + dma_at);
+  if (!dma_lines)
+    return;
+  printf("jitter cycles min %d max %d avg %.1f\n", jitter_min, jitter_max, (double)jitter_total / dma_lines);
+  printf("jitter pixels ");
+  for (i = 0; i < JITTER_BINS; i++)
+    printf(" %s:%u", jitter_labels[i], jitter_hist[i]);
+  printf("\nlines moved a pixel or more %u (%.2f%%)\n", dma_lines - jitter_hist[0],
+         100.0 * (dma_lines - jitter_hist[0]) / dma_lines);
+  printf("lines running into the next sync %u\n", spill_lines);
+  printf("lines lost (video interrupt still pending at the next compare) %u\n", sources[SRC_VIDEO].lost);
+  printf("worst field %u, %d cycles late\n", worst_field, worst_jitter);
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: ntscsim [-frames N] [-group reset|0..4] [-prio isr pre sub] [-dur isr min max]\n"
+                  "               [-profile file] [-dma N] [-baud N] [-rx N] [-keys N] [-exti] [-seed N] [-pgm file]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t frames = 60;
+  const char *pgm = NULL;
+  source_t *s;
+  int arg;
+
+  for (arg = 1; arg < argc; arg++)
+  {
+    if (!strcmp(argv[arg], "-frames") && arg+1 < argc)
+      frames = atoi(argv[++arg]);
+    else if (!strcmp(argv[arg], "-group") && arg+1 < argc)
+    {
+      arg++;
+      if (!strcmp(argv[arg], "reset"))
+        aircr = 0;
+      else if (argv[arg][0] >= '0' && argv[arg][0] <= '4' && !argv[arg][1])
+        aircr = 0x700 - (argv[arg][0] - '0') * 0x100;  /* NVIC_PriorityGroup_N */
+      else
+        usage();
+    }
+    else if (!strcmp(argv[arg], "-prio") && arg+3 < argc)
+    {
+      s = find_source(argv[arg+1]);
+      s->pre = atoi(argv[arg+2]);
+      s->sub = atoi(argv[arg+3]);
+      arg += 3;
+    }
+    else if (!strcmp(argv[arg], "-dur") && arg+3 < argc)
+    {
+      s = find_source(argv[arg+1]);
+      s->durmin = atoi(argv[arg+2]);
+      s->durmax = atoi(argv[arg+3]);
+      if (s->durmax < s->durmin)
+        s->durmax = s->durmin;
+      arg += 3;
+    }
+    else if (!strcmp(argv[arg], "-profile") && arg+1 < argc)
+      load_profile(argv[++arg]);
+    else if (!strcmp(argv[arg], "-dma") && arg+1 < argc)
+      dma_at = atoi(argv[++arg]);
+    else if (!strcmp(argv[arg], "-baud") && arg+1 < argc)
+      baud = atoi(argv[++arg]);
+    else if (!strcmp(argv[arg], "-rx") && arg+1 < argc)
+      rx_percent = atoi(argv[++arg]);
+    else if (!strcmp(argv[arg], "-keys") && arg+1 < argc)
+      keys_per_sec = atoi(argv[++arg]);
+    else if (!strcmp(argv[arg], "-exti"))
+    {
+      /* EXTI9_5_IRQn, one interrupt per clock edge */
+      exti = 1;
+      sources[SRC_KEYBOARD].irqn = 23;
+      sources[SRC_KEYBOARD].durmin = 100;
+      sources[SRC_KEYBOARD].durmax = 300;
+    }
+    else if (!strcmp(argv[arg], "-seed") && arg+1 < argc)
+      seed = atoi(argv[++arg]) | 1;
+    else if (!strcmp(argv[arg], "-pgm") && arg+1 < argc)
+      pgm = argv[++arg];
+    else
+      usage();
+  }
+  if (!baud || !frames)
+    usage();
+
+  simulate(frames);
+  report();
+  if (pgm)
+    write_pgm(pgm);
+  return 0;
+}
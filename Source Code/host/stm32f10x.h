@@ -0,0 +1,101 @@
+/*
+ * stm32f10x.h (host)
+ *
+ * Just enough of the device header for the terminal code (video.c, terminal.c, termconfig.c,
+ * profile.c, trace.c) to build on a PC without changes.  hardware.c fills in the functions.
+ * This directory comes before the real library on the include path, so it wins.
+ *
+ * (c) Massachusetts Institute of Technology 2010
+ * Permission granted for experimental and personal use;
+ * license for commercial sale available from MIT.
+ */
+
+#ifndef __STM32F10x_H
+#define __STM32F10x_H
+
+#include <stdint.h>
+
+#define __IO volatile
+#define __INLINE inline
+
+typedef enum {RESET = 0, SET = !RESET} FlagStatus, ITStatus;
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+
+/***** USART *****/
+
+typedef struct
+{
+  uint32_t USART_BaudRate;
+  uint16_t USART_WordLength;
+  uint16_t USART_StopBits;
+  uint16_t USART_Parity;
+  uint16_t USART_Mode;
+  uint16_t USART_HardwareFlowControl;
+} USART_InitTypeDef;
+
+typedef struct
+{
+  uint32_t unused;
+} USART_TypeDef;
+
+extern USART_TypeDef host_usart1;
+#define USART1 (&host_usart1)
+
+#define USART_WordLength_8b                  ((uint16_t)0x0000)
+#define USART_WordLength_9b                  ((uint16_t)0x1000)
+#define USART_StopBits_1                     ((uint16_t)0x0000)
+#define USART_StopBits_2                     ((uint16_t)0x2000)
+#define USART_Parity_No                      ((uint16_t)0x0000)
+#define USART_Parity_Even                    ((uint16_t)0x0400)
+#define USART_Parity_Odd                     ((uint16_t)0x0600)
+#define USART_Mode_Rx                        ((uint16_t)0x0004)
+#define USART_Mode_Tx                        ((uint16_t)0x0008)
+#define USART_HardwareFlowControl_None       ((uint16_t)0x0000)
+#define USART_FLAG_TXE                       ((uint16_t)0x0080)
+
+void USART_Init(USART_TypeDef* USARTx, USART_InitTypeDef* USART_InitStruct);
+void USART_SendData(USART_TypeDef* USARTx, uint16_t Data);
+FlagStatus USART_GetFlagStatus(USART_TypeDef* USARTx, uint16_t USART_FLAG);
+
+/***** The other init structures thinnerclient.h declares.  Nothing on the host looks inside them. *****/
+
+typedef struct { uint32_t unused; } GPIO_InitTypeDef;
+typedef struct { uint32_t unused; } TIM_TimeBaseInitTypeDef;
+typedef struct { uint32_t unused; } TIM_OCInitTypeDef;
+typedef struct { uint32_t unused; } TIM_ICInitTypeDef;
+typedef struct { uint32_t unused; } NVIC_InitTypeDef;
+typedef struct { uint32_t unused; } SPI_InitTypeDef;
+typedef struct { uint32_t unused; } DMA_InitTypeDef;
+
+/***** Cycle counter.  Reading DWT->CYCCNT gives host time, scaled to CPU_MHZ. *****/
+
+typedef struct
+{
+  __IO uint32_t CTRL;
+  __IO uint32_t CYCCNT;
+} DWT_Type;
+
+DWT_Type *host_dwt(void);
+#define DWT (host_dwt())
+#define DWT_CTRL_CYCCNTENA  0x00000001
+
+typedef struct
+{
+  __IO uint32_t DHCSR;
+  __IO uint32_t DCRSR;
+  __IO uint32_t DCRDR;
+  __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+extern CoreDebug_Type host_coredebug;
+#define CoreDebug (&host_coredebug)
+#define CoreDebug_DEMCR_TRCENA  (1ul << 24)
+
+/* Nothing runs concurrently on the host, so exclusive access always succeeds. */
+static __INLINE uint16_t __LDREXH(uint16_t *addr) { return *addr; }
+static __INLINE uint32_t __STREXH(uint16_t value, uint16_t *addr) { *addr = value; return 0; }
+static __INLINE void __CLREX(void) { }
+static __INLINE void __disable_irq(void) { }
+static __INLINE void __enable_irq(void) { }
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * stm32f10x_exti.h (host)
+ *
+ * See stm32f10x.h in this directory.
+ *
+ * (c) Massachusetts Institute of Technology 2010
+ * Permission granted for experimental and personal use;
+ * license for commercial sale available from MIT.
+ */
+
+#ifndef __STM32F10x_EXTI_H
+#define __STM32F10x_EXTI_H
+
+#include "stm32f10x.h"
+
+typedef struct { uint32_t unused; } EXTI_InitTypeDef;
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * input.c
+ *
+ * PS/2 scancode decoding, and the key and serial receive buffers the interrupt handlers fill.
+ * Split out of thinnerclient.c so it can be built without the hardware (see host/).
+ *
+ * David Cranor and Max Lobovsky (PS/2 stuff adapted from work by Matt Sarnoff)
+ * 8/30/10
+ *
+ * (c) Massachusetts Institute of Technology 2010
+ * Permission granted for experimental and personal use;
+ * license for commercial sale available from MIT.
+ */
+
+#include "thinnerclient.h"
+
+#include "keycodes.h"
+#include "profile.h"
+#include "trace.h"
+
+#include <stdint.h>
+#include "defs.h"
+
+#define ESC K_ESC
+#define CLK K_CAPSLK
+#define NLK K_NUMLK
+#define SLK K_SCRLK
+#define F1  K_F1
+#define F2  K_F2
+#define F3  K_F3
+#define F4  K_F4
+#define F5  K_F5
+#define F6  K_F6
+#define F7  K_F7
+#define F8  K_F8
+#define F9  K_F9
+#define F10 K_F10
+#define F11 K_F11
+#define F12 K_F12
+#define INS K_INS
+#define DEL K_DEL
+#define HOM K_HOME
+#define END K_END
+#define PGU K_PGUP
+#define PGD K_PGDN
+#define ARL K_LEFT
+#define ARR K_RIGHT
+#define ARU K_UP
+#define ARD K_DOWN
+#define PRS K_PRTSC
+#define BRK K_BREAK
+
+//Keyboard lookup tables
+__attribute__((section("FLASH"))) const char codetable[] = {
+	//   1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
+	0,   F9,  0,   F5,  F3,  F1,  F2,  F12, 0,   F10, F8,  F6,  F4,  '\t','`', 0,
+	0,   0,   0,   0,   0,   'q', '1', 0,   0,   0,   'z', 's', 'a', 'w', '2', 0,
+	0,   'c', 'x', 'd', 'e', '4', '3', 0,   0,   ' ', 'v', 'f', 't', 'r', '5', 0,
+	0,   'n', 'b', 'h', 'g', 'y', '6', 0,   0,   0,   'm', 'j', 'u', '7', '8', 0,
+	0,   ',', 'k', 'i', 'o', '0', '9', 0,   0,   '.', '/', 'l', ';', 'p', '-', 0,
+	0,   0,   '\'',0,   '[', '=', 0,   0,   CLK, 0,   '\n',']', 0,   '\\',0,   0,
+	0,   0,   0,   0,   0,   0,   '\b',0,   0,   '1', 0,   '4', '7', 0,   0,   0,
+	'0', '.', '2', '5', '6', '8', ESC,  NLK, F11, '+', '3', '-', '*', '9', SLK, 0,
+	0,   0,   0,   F7
+};
+
+__attribute__((section("FLASH"))) const char codetable_shifted[] = {
+	//   1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
+	0,   F9,  0,   F5,  F3,  F1,  F2,  F12, 0,   F10, F8,  F6,  F4,  '\t','~', 0,
+	0,   0,   0,   0,   0,   'Q', '!', 0,   0,   0,   'Z', 'S', 'A', 'W', '@', 0,
+	0,   'C', 'X', 'D', 'E', '$', '#', 0,   0,   ' ', 'V', 'F', 'T', 'R', '%', 0,
+	0,   'N', 'B', 'H', 'G', 'Y', '^', 0,   0,   0,   'M', 'J', 'U', '&', '*', 0,
+	0,   '<', 'K', 'I', 'O', ')', '(', 0,   0,   '>', '?', 'L', ':', 'P', '_', 0,
+	0,   0,   '"', 0,   '{', '+', 0,   0,   CLK, 0,   '\n','}', 0,   '|', 0,   0,
+	0,   0,   0,   0,   0,   0,   '\b',0,   0,   '1', 0,   '4', '7', 0,   0,   0,
+	'0', '.', '2', '5', '6', '8', ESC, NLK, F11, '+', '3', '-', '*', '9', SLK, 0,
+	0,   0,   0,   F7
+};
+
+//codes that follow E0 or E1
+
+__attribute__((section("FLASH"))) const char codetable_extended[] = {
+	//   1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
+	0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	0,   0,   PRS, 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '/', 0,   0,   0,   0,   0,
+	0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '\n',0,   0,   0,   0,   0,
+	0,   0,   0,   0,   0,   0,   0,   0,   0,   END, 0,   ARL, HOM, 0,   0,   0,
+	INS, DEL, ARD, '5', ARR, ARU, 0,   BRK, 0,   0,   PGD, 0,   PRS, PGU, 0,   0,
+	0,   0,   0,   0
+};
+
+/* keyboard state */
+static int8_t keyup = 0;
+static int8_t extended = 0;
+static int8_t mods = 0;
+
+/* circular buffer for keys */
+#define MAX_KEY_BUF 32
+volatile uint8_t charbufsize = 0;
+volatile uint8_t charbuf[MAX_KEY_BUF];
+volatile uint8_t charbufhead = 0;
+volatile uint8_t charbuftail = 0;
+
+/* circular UART buffer */
+#define MAX_BUF 254
+volatile uint8_t bufsize;
+volatile uint8_t buf[MAX_BUF];
+volatile uint8_t bufhead;
+volatile uint8_t buftail;
+
+/* counters for the status line */
+volatile uint32_t rxBytes = 0;
+volatile uint8_t bufHighWater = 0;
+volatile uint16_t bufOverruns = 0;
+volatile uint32_t keyLatencyMax = 0;
+static volatile uint32_t keyStamp = 0;
+
+//Partway through a break or extended code?
+uint8_t decode_busy(void)
+{
+	return keyup || extended;
+}
+
+//Decode PS/2 keycodes
+void decode(uint8_t code)
+{
+	if (code == 0xF0)
+		keyup = 1;
+	else if (code == 0xE0 || code == 0xE1)
+		extended = 1;
+	else
+	{
+		if (keyup) // handling a key release; don't do anything
+		{
+			if (code == 0x12) // left shift
+				mods &= ~_BV(0);
+			else if (code == 0x59) // right shift
+				mods &= ~_BV(1);
+			else if (code == 0x14) // left/right ctrl
+				mods &= (extended) ? ~_BV(3) : ~_BV(2);
+			else if (code == 0x58 && !extended) // caps lock
+				mods &= ~_BV(5);
+		}
+		else // handling a key press; store character
+		{
+			if (code == 0x12) // left shift
+				mods |= _BV(0);
+			else if (code == 0x59) // right shift
+				mods |= _BV(1);
+			else if (code == 0x14) // left/right ctrl
+				mods |= (extended) ? _BV(3) : _BV(2);
+			else if (code == 0x58 && !extended) // caps lock toggles, and the keyboard's light follows it
+			{
+				if (!(mods & _BV(5))) // but not again each time it repeats while held down
+				{
+					mods |= _BV(5);
+					mods ^= _BV(4);
+					ps2_set_led(PS2_LED_CAPS, mods & _BV(4));
+				}
+			}
+			else if (code <= 0x83)
+			{
+				uint8_t chr;
+				if (extended)
+					chr = codetable_extended[code];
+				else if (mods & 0b1100) // ctrl
+					chr = codetable[code] & 31;
+				else if (mods & 0b0011) // shift
+					chr = codetable_shifted[code];
+				else
+					chr = codetable[code];
+				
+				if ((mods & _BV(4)) && ((chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z'))) // caps lock flips letters only
+					chr ^= 0x20;
+				
+				if (!chr) chr = '?';
+				
+				// add to buffer
+				if (charbufsize < MAX_KEY_BUF)
+				{
+					charbuf[charbuftail] = chr;
+					keyStamp = profile_cycles();
+					trace_at(TRACE_KEY, keyStamp, chr);
+					if (++charbuftail >= MAX_KEY_BUF) charbuftail = 0;
+					charbufsize++;
+				}
+			}
+		}
+		extended = 0;
+		keyup = 0;
+	}
+}
+
+/*********Key and serial buffer stuff.  Needs to be updated to support atomic writing (if possible without messing up screen drawing, the sizes get mismatched easily******/
+uint8_t buffer_get_key()
+{
+	if (charbufsize == 0)
+		return 0;
+	
+	uint8_t newchar = charbuf[charbufhead];
+	if (++charbufhead >= MAX_KEY_BUF) charbufhead = 0;
+	charbufsize--;
+	
+	//only the newest key is timestamped, so only time the one that empties the buffer
+	if (charbufsize == 0)
+	{
+		uint32_t latency = profile_cycles() - keyStamp;
+		if (latency > keyLatencyMax) keyLatencyMax = latency;
+	}
+	
+	return newchar;
+}
+
+uint8_t key_buf_size()
+{
+	uint8_t sz;
+	sz = charbufsize;
+	return sz;
+}
+
+
+void buf_clear()
+{
+	bufsize = bufhead = buftail = 0;
+}
+
+void buf_enqueue(uint8_t c)
+{
+	uint8_t next = buftail + 1;
+	uint8_t fill;
+	if (next >= MAX_BUF) next = 0;
+	
+	rxBytes++;
+	trace(TRACE_ENQUEUE, c);
+	
+	//full.  drop the byte; writing it would make tail catch up with head and the whole buffer would look empty
+	if (next == bufhead)
+	{
+		bufOverruns++;
+		return;
+	}
+	
+	buf[buftail] = c;
+	buftail = next;
+	bufsize++;
+	
+	fill = (buftail >= bufhead) ? buftail - bufhead : MAX_BUF - bufhead + buftail;
+	if (fill > bufHighWater) bufHighWater = fill;
+}
+
+uint8_t buf_dequeue()
+{
+	uint8_t ret = 0;
+	if (1) //bufsize > 0)
+	{
+		uint8_t c = buf[bufhead];
+		trace(TRACE_DEQUEUE, c);
+		if (++bufhead >= MAX_BUF) bufhead = 0;
+		bufsize--;
+		ret = c;
+	}
+	return ret;
+}
+
+uint8_t buf_size()
+{
+	uint8_t sz;
+	sz = bufsize;
+	return sz;
+}
+
+
+/*************End of key and serial buffer stuff********************/
@@ -24,6 +24,54 @@
 #include "defs.h"
 
 #include "thinnerclient.h"
+#include "profile.h"
+
+//Append label, n and unit to the status line being built at p.  Returns the new end of the line.
+static char *status_field(char *p, const char *label, uint32_t n, const char *unit)
+{
+	while (*label) *p++ = *label++;
+	p += sprintdec(p, n);
+	while (*unit) *p++ = *unit++;
+	*p = '\0';
+	return p;
+}
+
+//Once a second, put throughput numbers on the status line (if it's turned on in setup).
+static void update_status_line(void)
+{
+	static uint16_t lastFrame = 0;
+	static uint32_t lastRx = 0;
+	static uint32_t lastRenders = 0;
+	
+	char line[TILES_WIDE*2];  //room to spare; video_statusline() cuts it off at the screen edge
+	char *p = line;
+	uint16_t frames = frameCount - lastFrame;
+	uint32_t rx, renders, drawn;
+	
+	if (frames < 60)
+		return;
+	
+	rx = rxBytes;
+	renders = renderCount;
+	drawn = renders - lastRenders;
+	
+	p = status_field(p, "RX ", (rx - lastRx) * 60 / frames, " B/s");
+	p = status_field(p, "  buf hi ", bufHighWater, "");
+	p = status_field(p, " ovr ", bufOverruns, "");
+	p = status_field(p, "  draw ", renderCyclesMax / CPU_MHZ, "us");
+	p = status_field(p, "  skip ", (drawn < frames) ? (frames - drawn) * 60 / frames : 0, "/s");
+	p = status_field(p, "  isr ", profile_load_recent(), "%");
+	p = status_field(p, "  key ", keyLatencyMax / CPU_MHZ, "us");
+	video_statusline(line);
+	
+	//high water marks are per second; overruns keep adding up so the odd one isn't missed
+	lastFrame += frames;
+	lastRx = rx;
+	lastRenders = renders;
+	bufHighWater = 0;
+	renderCyclesMax = 0;
+	keyLatencyMax = 0;
+}
 
 int main(void){
 	
@@ -55,5 +103,7 @@ int main(void){
 		
 		//Copy tilemap into main framebuffer
 		updateFrameBuffer(tileMap, Font6x8);
+		
+		update_status_line();
 	}
 }
\ No newline at end of file
@@ -0,0 +1,193 @@
+/*
+ * profile.c
+ *
+ * Interrupt latency and duration measurement using the Cortex-M3 DWT cycle counter
+ *
+ * (c) Massachusetts Institute of Technology 2010
+ * Permission granted for experimental and personal use;
+ * license for commercial sale available from MIT.
+ */
+
+#include "profile.h"
+#include "trace.h"
+#include "thinnerclient.h"
+#include "video.h"
+
+#include <stdint.h>
+#include <string.h>
+
+isrprofile_t isrProfile[PROFILE_NUM_ISRS];
+
+static const char *profilenames[PROFILE_NUM_ISRS] = {
+  "video   ",
+  "usart   ",
+  "keyboard"
+};
+
+static uint8_t profile_bin(uint16_t cycles)
+{
+  /* log2, shifted down so the first bin holds everything that's quick */
+  int8_t bin = (31 - __builtin_clz(cycles | 1)) - PROFILE_HIST_SHIFT;
+  if (bin < 0) bin = 0;
+  if (bin >= PROFILE_HIST_BINS) bin = PROFILE_HIST_BINS-1;
+  return bin;
+}
+
+void profile_setup(void)
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA;
+
+  profile_reset();
+}
+
+static void profile_clear(void)
+{
+  uint8_t i;
+  memset(isrProfile, 0, sizeof(isrProfile));
+  for (i = 0; i < PROFILE_NUM_ISRS; i++)
+    isrProfile[i].durmin = isrProfile[i].latmin = 0xFFFF;
+}
+
+void profile_reset(void)
+{
+  /* the handlers update these as they go, so none may cut in halfway through */
+  __disable_irq();
+  profile_clear();
+  __enable_irq();
+}
+
+void profile_isr(uint8_t isr, uint32_t start, uint16_t latency)
+{
+  uint32_t cycles = profile_cycles() - start;
+  isrprofile_t *p = &isrProfile[isr];
+  uint16_t dur = (cycles > 0xFFFF) ? 0xFFFF : cycles;
+
+  p->count++;
+  p->total += cycles;
+  if (dur < p->durmin) p->durmin = dur;
+  if (dur > p->durmax) p->durmax = dur;
+  if (p->durhist[profile_bin(dur)] != 0xFFFF)
+    p->durhist[profile_bin(dur)]++;
+
+  if (isr == PROFILE_VIDEO)
+  {
+    if (latency < p->latmin) p->latmin = latency;
+    if (latency > p->latmax) p->latmax = latency;
+    if (p->lathist[profile_bin(latency)] != 0xFFFF)
+      p->lathist[profile_bin(latency)]++;
+  }
+
+  trace_at(TRACE_ISR_IN + 2*isr, start, latency);
+  trace_at(TRACE_ISR_OUT + 2*isr, start + cycles, 0);
+}
+
+static uint64_t profile_busy(const isrprofile_t *prof)
+{
+  uint64_t busy = 0;
+  uint8_t i;
+  for (i = 0; i < PROFILE_NUM_ISRS; i++)
+    busy += prof[i].total;
+  return busy;
+}
+
+static uint8_t profile_load_of(const isrprofile_t *prof)
+{
+  /* the video interrupt runs once a line, so it doubles as the clock */
+  uint64_t elapsed = (uint64_t)prof[PROFILE_VIDEO].count * (TIMER_PERIOD+1);
+
+  if (!elapsed)
+    return 0;
+  return (profile_busy(prof) * 100) / elapsed;
+}
+
+uint8_t profile_load(void)
+{
+  return profile_load_of(isrProfile);
+}
+
+uint8_t profile_load_recent(void)
+{
+  static uint32_t lastlines;
+  static uint64_t lastbusy;
+  uint32_t lines = isrProfile[PROFILE_VIDEO].count;
+  uint64_t busy = profile_busy(isrProfile);
+  uint64_t elapsed;
+  uint8_t load = 0;
+
+  /* a report reset the numbers since last time */
+  if (lines < lastlines || busy < lastbusy)
+    lastlines = lastbusy = 0;
+
+  elapsed = (uint64_t)(lines - lastlines) * (TIMER_PERIOD+1);
+  if (elapsed)
+    load = ((busy - lastbusy) * 100) / elapsed;
+  lastlines = lines;
+  lastbusy = busy;
+  return load;
+}
+
+/***** Serial report *****/
+
+void profile_puts(const char *str)
+{
+  while (*str)
+  {
+    while(USART_GetFlagStatus(USART1, USART_FLAG_TXE) == RESET);
+    USART_SendData(USART1, *str++);
+  }
+}
+
+void profile_putnum(uint32_t n)
+{
+  char str[11];
+  sprintdec(str, n);
+  profile_puts(str);
+  profile_puts(" ");
+}
+
+static void profile_puthist(const char *label, const uint16_t *hist)
+{
+  uint8_t i;
+  profile_puts(label);
+  for (i = 0; i < PROFILE_HIST_BINS; i++)
+    profile_putnum(hist[i]);
+  profile_puts("\r\n");
+}
+
+void profile_report(void)
+{
+  isrprofile_t snap[PROFILE_NUM_ISRS];
+  uint8_t i;
+  isrprofile_t *p;
+
+  /* take the numbers and start again in one go, so no handler's run is half in each */
+  __disable_irq();
+  memcpy(snap, isrProfile, sizeof(snap));
+  profile_clear();
+  __enable_irq();
+
+  profile_puts("\r\nisr      count durmin durmax latmin latmax\r\n");
+  for (i = 0; i < PROFILE_NUM_ISRS; i++)
+  {
+    p = &snap[i];
+    profile_puts(profilenames[i]);
+    profile_puts(" ");
+    profile_putnum(p->count);
+    profile_putnum(p->count ? p->durmin : 0);
+    profile_putnum(p->durmax);
+    if (i == PROFILE_VIDEO)
+    {
+      profile_putnum(p->count ? p->latmin : 0);
+      profile_putnum(p->latmax);
+    }
+    profile_puts("\r\n");
+    profile_puthist("  dur hist ", p->durhist);
+    if (i == PROFILE_VIDEO)
+      profile_puthist("  lat hist ", p->lathist);
+  }
+  profile_puts("load % ");
+  profile_putnum(profile_load_of(snap));
+  profile_puts("\r\n");
+}
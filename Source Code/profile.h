@@ -0,0 +1,88 @@
+/*
+ * profile.h
+ *
+ * Interrupt latency and duration measurement using the Cortex-M3 DWT cycle counter
+ *
+ * Each handler calls profile_isr() on its way out with the cycle count it read on the way in.
+ * That also puts its entry and exit in the event trace (trace.h), if it's built in.
+ * The video interrupt also reports how many cycles after its compare event it started running.
+ * Send ESC [ 200 n to get a report back over the serial port (the numbers are reset afterwards).
+ *
+ * (c) Massachusetts Institute of Technology 2010
+ * Permission granted for experimental and personal use;
+ * license for commercial sale available from MIT.
+ */
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include "stm32f10x.h"
+#include <stdint.h>
+
+/* The CMSIS core header we ship predates the DWT definitions, so here is the bit we use. */
+#ifndef DWT
+typedef struct
+{
+  __IO uint32_t CTRL;
+  __IO uint32_t CYCCNT;
+} DWT_Type;
+
+#define DWT           ((DWT_Type *) 0xE0001000)
+#define DWT_CTRL_CYCCNTENA  0x00000001
+#endif
+
+/* Handlers being watched */
+enum
+{
+  PROFILE_VIDEO,      /* TIM2_IRQHandler */
+  PROFILE_USART,      /* USART1_IRQHandler */
+  PROFILE_KEYBOARD,   /* EXTI9_5_IRQHandler, or the DMA/TIM1 keyboard handlers */
+  PROFILE_NUM_ISRS
+};
+
+/* Histogram bin n counts [2^(n+5), 2^(n+6)) cycles; the first and last bins are open ended. */
+#define PROFILE_HIST_BINS 8
+#define PROFILE_HIST_SHIFT 5
+
+typedef struct
+{
+  uint32_t count;
+  uint64_t total;                       /* cycles spent in the handler */
+  uint16_t durmin, durmax;
+  uint16_t latmin, latmax;              /* only filled in for the video interrupt */
+  uint16_t durhist[PROFILE_HIST_BINS];
+  uint16_t lathist[PROFILE_HIST_BINS];
+} isrprofile_t;
+
+extern isrprofile_t isrProfile[PROFILE_NUM_ISRS];
+
+/* Read the cycle counter. */
+static __INLINE uint32_t profile_cycles(void)
+{
+  return DWT->CYCCNT;
+}
+
+/* Start the cycle counter and clear the statistics. */
+void profile_setup(void);
+
+/* Clear the statistics.  Interrupts are off while it does. */
+void profile_reset(void);
+
+/* Record one run of a handler that started at cycle count start.  latency is how late it started,
+ * in cycles, or 0 if that isn't known. */
+void profile_isr(uint8_t isr, uint32_t start, uint16_t latency);
+
+/* Percentage of the CPU spent in the handlers since the last reset. */
+uint8_t profile_load(void);
+
+/* The same, but since the last call to this function.  Used by the status line. */
+uint8_t profile_load_recent(void);
+
+/* Send a human readable summary out of USART1.  The numbers are taken and reset together first. */
+void profile_report(void);
+
+/* Blocking writes to USART1 for the reports.  profile_putnum() adds a space after the number. */
+void profile_puts(const char *str);
+void profile_putnum(uint32_t n);
+
+#endif
@@ -103,6 +103,32 @@ const termparam_t p_revvideo = {
   0
 };
 
+/* typematic rate and delay bits, ORed together for ps2_set_typematic() */
+const termparam_t p_repeatrate = {
+  "Repeat rate cps",
+  { "2", "5", "10.9", "20", "30" },
+  { 0x1F, 0x14, 0x0B, 0x04, 0x00 },
+  5,
+  2
+};
+
+const termparam_t p_repeatdelay = {
+  "Repeat delay ms",
+  { "250", "500", "750", "1000" },
+  { 0x00, 0x20, 0x40, 0x60 },
+  4,
+  1
+};
+
+/* takes the bottom line for throughput numbers (see main.c) */
+const termparam_t p_statusline = {
+  "Status line",
+  { "Off", "On" },
+  { 0, 1 },
+  2,
+  0
+};
+
 static const termparam_t *params[] = {
   &p_baudrate,
   &p_databits,
@@ -111,7 +137,10 @@ static const termparam_t *params[] = {
   &p_enterchar,
   &p_localecho,
   &p_escseqs,
-  &p_revvideo
+  &p_revvideo,
+  &p_repeatrate,
+  &p_repeatdelay,
+  &p_statusline
 };
 
 static uint32_t profile1[TC_NUM_PARAMS];
@@ -170,9 +199,19 @@ void cfg_print_line(uint8_t linenum)
 static int8_t currparam;
 static uint8_t currprof;
 
+/* Profile on top, then the parameters one per line, then save, with a gap either side */
+static uint8_t setup_line(int8_t param)
+{
+  if (param < 0)
+    return 2;
+  if (param == TC_NUM_PARAMS)
+    return 5 + param;
+  return 4 + param;
+}
+
 static void setup_print_line(int8_t param)
 {
-  uint8_t linenum = 4 + 2*param;
+  uint8_t linenum = setup_line(param);
   video_gotoxy(0, linenum);
   video_clrline();
 
@@ -205,6 +244,7 @@ void setup_redraw()
   video_clrscr();
 
   int8_t i;
+  int8_t bottom = video_rows()-1;
   for (i = -1; i < TC_NUM_PARAMS+1; i++)
     setup_print_line(i);
   
@@ -212,19 +252,19 @@ void setup_redraw()
   for (i = 1; i < TILES_WIDE-1; i++)
   {
     video_putcxy(i, 0, '\x12');
-    video_putcxy(i, TILES_HIGH-1, '\x12');
+    video_putcxy(i, bottom, '\x12');
   }
-  for (i = 1; i < TILES_HIGH-1; i++)
+  for (i = 1; i < bottom; i++)
   {
     video_putcxy(0, i, '\x19');
     video_putcxy(TILES_WIDE-1, i, '\x19');
   }
   video_putcxy(0, 0, '\x0D');
   video_putcxy(TILES_WIDE-1, 0, '\x0C');
-  video_putcxy(0, TILES_HIGH-1, '\x0E');
-  video_putcxy(TILES_WIDE-1, TILES_HIGH-1, '\x0B');
+  video_putcxy(0, bottom, '\x0E');
+  video_putcxy(TILES_WIDE-1, bottom, '\x0B');
 
-  video_putsxy(5, TILES_HIGH-2, "\x03\x04: select     Enter: change     Esc: quit");
+  video_putsxy(5, bottom-1, "\x03\x04: select     Enter: change     Esc: quit");
 }
 
 void setup_start()
@@ -29,6 +29,9 @@ enum
   TC_LOCALECHO,
   TC_ESCSEQS,
   TC_REVVIDEO,
+  TC_REPEATRATE,
+  TC_REPEATDELAY,
+  TC_STATUSLINE,
   TC_NUM_PARAMS
 };
 
@@ -19,6 +19,8 @@
 #include "termconfig.h"
 
 #include "thinnerclient.h"
+#include "profile.h"
+#include "trace.h"
 
 #include "stm32f10x.h"
 
@@ -28,6 +30,10 @@
 
 #define MAX_ESC_LEN 48
 
+/* private device status reports (ESC [ n n) */
+#define DSR_PROFILE 200  /* interrupt timing report, see profile.h */
+#define DSR_TRACE   201  /* event trace dump, see trace.h */
+
 /* key sequences sent by non-ASCII keys */
 static const char * specialkeyseqs[K_NUMLK-K_F1] = {
 	"\x1BOP",   /* F1 */
@@ -329,10 +335,20 @@ void escseq_process_csi(char c)
 			}
 				break;
 				
+			case 'n': /* device status report */
+			{
+				uint8_t report = escseq_get_param(0);
+				if (report == DSR_PROFILE)
+					profile_report();
+				else if (report == DSR_TRACE)
+					trace_report();
+			}
+				break;
+				
 			case 'r': /* set top and bottom margins */
 			{
 				uint8_t top = escseq_get_param(1);
-				uint8_t bottom = escseq_get_param(TILES_HIGH);
+				uint8_t bottom = escseq_get_param(video_rows());
 				video_set_margins(top-1, bottom-1);
 				break;
 			}
@@ -431,11 +447,14 @@ void apply_config()
 	uart_update();
 	
 	video_set_reverse(cfg_param_value(TC_REVVIDEO));
+	video_set_statusline(cfg_param_value(TC_STATUSLINE));
 	
 	/* cache the values from the config struct */
 	newlineseq = cfg_param_value(TC_ENTERCHAR);
 	process_escseqs = cfg_param_value(TC_ESCSEQS);
 	local_echo = cfg_param_value(TC_LOCALECHO);
+	
+	ps2_set_typematic(cfg_param_value(TC_REPEATRATE) | cfg_param_value(TC_REPEATDELAY));
 }
 
 void app_setup()
@@ -481,6 +500,7 @@ void app_handle_key(uint8_t key)
 		if (finish)
 		{
 			in_setup = false;
+			ps2_set_led(PS2_LED_NUM, 0);
 			if (finish == SETUP_SAVE) /* need to reapply settings */
 				apply_config();
 			setup_leave();
@@ -491,6 +511,7 @@ void app_handle_key(uint8_t key)
 		if (key == K_NUMLK) /* start setup */
 		{
 			in_setup = true;
+			ps2_set_led(PS2_LED_NUM, 1); /* NumLock light shows the setup screen is up */
 			setup_start();
 		}
 		else if (key == '\n') /* send appropriate newline sequence */
@@ -21,6 +21,8 @@
 #include "keycodes.h"
 #include "termconfig.h"
 #include "terminal.h"
+#include "profile.h"
+#include "trace.h"
 
 #include <stdint.h>
 #include "defs.h"
@@ -35,14 +37,13 @@ SPI_InitTypeDef				SPI_InitStructure;
 DMA_InitTypeDef				DMA_InitStructure;
 USART_InitTypeDef			USART_InitStructure;
 EXTI_InitTypeDef			EXTI_InitStructure;
+TIM_ICInitTypeDef			TIM_ICInitStructure;
 
-//Timer stuf to generate sync and video display.  Need to tweak these if doing a PAL port.
-#define TIMER_PERIOD 5083
-#define INTERRUPT_DELAY 700
 uint16_t CCR2_Val = 380;
 uint16_t PrescalerValue = 0;
 
 volatile uint16_t lineCount = 0;
+volatile uint16_t frameCount = 0;
 
 //PLL hackery
 void overclockSystemInit(void);
@@ -60,109 +61,51 @@ void EXTI_Config(void);
 //Interrupt handlers
 void TIM2_IRQHandler(void);			//Sync interrupt
 void USART1_IRQHandler(void);		//USART received stuff interrupt
+#ifdef PS2_CAPTURE_DMA
+void DMA1_Channel2_IRQHandler(void);	//Keyboard frame captured
+void TIM1_UP_IRQHandler(void);		//Keyboard frame timed out
+#else
 void EXTI9_5_IRQHandler(void);		//Keyboard interrupt handler
-
-//Decode a keypress
-void decode(uint8_t code);
+#endif
 
 //The framebuffer itself
 uint16_t frameBuffer[BUFFER_VERT_SIZE][BUFFER_LINE_LENGTH];
 
 uint32_t charCounter = 0;
 
-#define ESC K_ESC
-#define CLK K_CAPSLK
-#define NLK K_NUMLK
-#define SLK K_SCRLK
-#define F1  K_F1
-#define F2  K_F2
-#define F3  K_F3
-#define F4  K_F4
-#define F5  K_F5
-#define F6  K_F6
-#define F7  K_F7
-#define F8  K_F8
-#define F9  K_F9
-#define F10 K_F10
-#define F11 K_F11
-#define F12 K_F12
-#define INS K_INS
-#define DEL K_DEL
-#define HOM K_HOME
-#define END K_END
-#define PGU K_PGUP
-#define PGD K_PGDN
-#define ARL K_LEFT
-#define ARR K_RIGHT
-#define ARU K_UP
-#define ARD K_DOWN
-#define PRS K_PRTSC
-#define BRK K_BREAK
-
-
-//Keyboard lookup tables
-__attribute__((section("FLASH"))) const char codetable[] = {
-	//   1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
-	0,   F9,  0,   F5,  F3,  F1,  F2,  F12, 0,   F10, F8,  F6,  F4,  '\t','`', 0,
-	0,   0,   0,   0,   0,   'q', '1', 0,   0,   0,   'z', 's', 'a', 'w', '2', 0,
-	0,   'c', 'x', 'd', 'e', '4', '3', 0,   0,   ' ', 'v', 'f', 't', 'r', '5', 0,
-	0,   'n', 'b', 'h', 'g', 'y', '6', 0,   0,   0,   'm', 'j', 'u', '7', '8', 0,
-	0,   ',', 'k', 'i', 'o', '0', '9', 0,   0,   '.', '/', 'l', ';', 'p', '-', 0,
-	0,   0,   '\'',0,   '[', '=', 0,   0,   CLK, 0,   '\n',']', 0,   '\\',0,   0,
-	0,   0,   0,   0,   0,   0,   '\b',0,   0,   '1', 0,   '4', '7', 0,   0,   0,
-	'0', '.', '2', '5', '6', '8', ESC,  NLK, F11, '+', '3', '-', '*', '9', SLK, 0,
-	0,   0,   0,   F7
-};
+/* keyboard init */
+#ifndef PS2_CAPTURE_DMA
+static int8_t bitcount = 11;
+static uint8_t scancode = 0;
+#endif
 
-__attribute__((section("FLASH"))) const char codetable_shifted[] = {
-	//   1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
-	0,   F9,  0,   F5,  F3,  F1,  F2,  F12, 0,   F10, F8,  F6,  F4,  '\t','~', 0,
-	0,   0,   0,   0,   0,   'Q', '!', 0,   0,   0,   'Z', 'S', 'A', 'W', '@', 0,
-	0,   'C', 'X', 'D', 'E', '$', '#', 0,   0,   ' ', 'V', 'F', 'T', 'R', '%', 0,
-	0,   'N', 'B', 'H', 'G', 'Y', '^', 0,   0,   0,   'M', 'J', 'U', '&', '*', 0,
-	0,   '<', 'K', 'I', 'O', ')', '(', 0,   0,   '>', '?', 'L', ':', 'P', '_', 0,
-	0,   0,   '"', 0,   '{', '+', 0,   0,   CLK, 0,   '\n','}', 0,   '|', 0,   0,
-	0,   0,   0,   0,   0,   0,   '\b',0,   0,   '1', 0,   '4', '7', 0,   0,   0,
-	'0', '.', '2', '5', '6', '8', ESC, NLK, F11, '+', '3', '-', '*', '9', SLK, 0,
-	0,   0,   0,   F7
-};
+#ifdef PS2_CAPTURE_DMA
+/* One 32 bit word per keyboard clock edge.  When receiving, DMA fills it with GPIOA->IDR samples.
+ * When sending, DMA copies it into GPIOA->BSRR to drive the data line. */
+static volatile uint32_t ps2Bits[PS2_FRAME_BITS];
+volatile uint8_t ps2FrameErrors = 0;
 
-//codes that follow E0 or E1
-
-__attribute__((section("FLASH"))) const char codetable_extended[] = {
-	//   1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
-	0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-	0,   0,   PRS, 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-	0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-	0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-	0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '/', 0,   0,   0,   0,   0,
-	0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '\n',0,   0,   0,   0,   0,
-	0,   0,   0,   0,   0,   0,   0,   0,   0,   END, 0,   ARL, HOM, 0,   0,   0,
-	INS, DEL, ARD, '5', ARR, ARU, 0,   BRK, 0,   0,   PGD, 0,   PRS, PGU, 0,   0,
-	0,   0,   0,   0
+/* host to keyboard commands */
+enum
+{
+	PS2_IDLE,
+	PS2_INHIBIT,   //holding the clock low before a request to send
+	PS2_SENDING,   //keyboard is clocking our byte out
+	PS2_WAIT_ACK,  //byte is out, waiting for 0xFA
 };
+static volatile uint8_t ps2State = PS2_IDLE;
+static uint8_t ps2TxBytes[2];
+static uint8_t ps2TxLen = 0;
+static uint8_t ps2TxPos = 0;
 
+static void ps2_dma_setup(uint8_t transmit);
+#endif
 
-/* keyboard init */
-static int8_t keyup = 0;
-static int8_t extended = 0;
-static int8_t bitcount = 11;
-static uint8_t scancode = 0;
-static int8_t mods = 0;
-
-/* circular buffer for keys */
-#define MAX_KEY_BUF 32
-volatile uint8_t charbufsize = 0;
-volatile uint8_t charbuf[MAX_KEY_BUF];
-volatile uint8_t charbufhead = 0;
-volatile uint8_t charbuftail = 0;
-
-/* circular UART buffer */
-#define MAX_BUF 254
-volatile uint8_t bufsize;
-volatile uint8_t buf[MAX_BUF];
-volatile uint8_t bufhead;
-volatile uint8_t buftail;
+/* Things the keyboard should be told.  Set from anywhere, cleared by ps2_kick() once the command is on its way. */
+static volatile uint8_t ps2WantLeds = 0;
+static volatile uint8_t ps2WantTypematic = 0;
+static volatile uint8_t ps2Leds = 0;
+static volatile uint8_t ps2Typematic = PS2_TYPEMATIC_DEFAULT;
 
 void thinnerClientSetup(void)
 {
@@ -175,6 +118,9 @@ void thinnerClientSetup(void)
 	//Set up the system clocks
 	RCC_Config();
 	
+	//Start the cycle counter for interrupt profiling
+	profile_setup();
+	
 	// Setup the GPIOs
 	GPIO_Config();
 	
@@ -205,6 +151,9 @@ void RCC_Config(void)
 	RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA | RCC_APB2Periph_GPIOB | RCC_APB2Periph_SPI1 | RCC_APB2Periph_GPIOA | RCC_APB2Periph_AFIO, ENABLE);	
 	RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1 , ENABLE);	
 	RCC_APB2PeriphClockCmd(RCC_APB2Periph_USART1, ENABLE);
+#ifdef PS2_CAPTURE_DMA
+	RCC_APB2PeriphClockCmd(RCC_APB2Periph_TIM1, ENABLE);
+#endif
 }
 
 void GPIO_Config(void)
@@ -222,12 +171,22 @@ void GPIO_Config(void)
 	
 	GPIO_Init(GPIOA, &GPIO_InitStructure);
 	
+#ifdef PS2_CAPTURE_DMA
+	//Keyboard clock and data are open drain so we can talk back.  Released (high) they still read (and capture) like inputs.
+	GPIO_SetBits(GPIOA, GPIO_Pin_8 | GPIO_Pin_11);
+	GPIO_InitStructure.GPIO_Pin = GPIO_Pin_8 | GPIO_Pin_11;
+	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_Out_OD;
+	GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
+	
+	GPIO_Init(GPIOA, &GPIO_InitStructure);
+#else
 	GPIO_InitStructure.GPIO_Pin = GPIO_Pin_8 | GPIO_Pin_11; //setting up for keyboard pin change interrupts.
 	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IN_FLOATING;
 	GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
 	
 	GPIO_Init(GPIOA, &GPIO_InitStructure);
 	GPIO_EXTILineConfig( GPIO_PortSourceGPIOA, GPIO_PinSource8 );  //connect exti
+#endif
 	
 	
 	/* Configure USART1 Rx as input floating */
@@ -278,16 +237,62 @@ void TIM_Config(void)
 	
 	/* TIM2 enable counter */
   	TIM_Cmd(TIM2, ENABLE);
+	
+#ifdef PS2_CAPTURE_DMA
+	/* TIM1 watches the keyboard clock on PA8.  Every falling edge is a capture event on channel 1, which asks DMA1 channel 2
+	 * to grab the data line.  The first edge of a frame also starts the counter (trigger mode, one pulse), so if the frame
+	 * isn't finished PS2_FRAME_TIMEOUT us later we get an update interrupt and resync. */
+	TIM_TimeBaseStructure.TIM_Period = PS2_FRAME_TIMEOUT;
+	TIM_TimeBaseStructure.TIM_Prescaler = 79; //80MHz/80 = 1us ticks
+	TIM_TimeBaseStructure.TIM_ClockDivision = 0;
+	TIM_TimeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
+	TIM_TimeBaseStructure.TIM_RepetitionCounter = 0;
+	
+	TIM_TimeBaseInit(TIM1, &TIM_TimeBaseStructure);
+	
+	TIM_ICInitStructure.TIM_Channel = TIM_Channel_1;
+	TIM_ICInitStructure.TIM_ICPolarity = TIM_ICPolarity_Falling;
+	TIM_ICInitStructure.TIM_ICSelection = TIM_ICSelection_DirectTI;
+	TIM_ICInitStructure.TIM_ICPrescaler = TIM_ICPSC_DIV1;
+	TIM_ICInitStructure.TIM_ICFilter = 0x6; //ignore glitches shorter than ~0.3us
+	
+	TIM_ICInit(TIM1, &TIM_ICInitStructure);
+	
+	TIM_SelectInputTrigger(TIM1, TIM_TS_TI1FP1);
+	TIM_SelectSlaveMode(TIM1, TIM_SlaveMode_Trigger);
+	TIM_SelectOnePulseMode(TIM1, TIM_OPMode_Single);
+	
+	TIM_DMACmd(TIM1, TIM_DMA_CC1, ENABLE);
+	
+	/* TIM_TimeBaseInit leaves an update pending, don't let it look like a timeout */
+	TIM_ClearITPendingBit(TIM1, TIM_IT_Update);
+	TIM_ITConfig(TIM1, TIM_IT_Update, ENABLE);
+#endif
 }
 
 void NVIC_Config(void)
 {
+#ifndef PS2_CAPTURE_DMA
 	// Enable the EXTI9_5 Interrupt for keyboard transmissions
 	NVIC_InitStructure.NVIC_IRQChannel	= EXTI9_5_IRQn;
 	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority	= 2;
 	NVIC_InitStructure.NVIC_IRQChannelCmd	= ENABLE;
 	
 	NVIC_Init(&NVIC_InitStructure);
+#else
+	//Whole keyboard frames and keyboard timeouts replace the EXTI interrupt, at the same priority
+	NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel2_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 2;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	
+	NVIC_Init(&NVIC_InitStructure);
+	
+	NVIC_InitStructure.NVIC_IRQChannel = TIM1_UP_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 2;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	
+	NVIC_Init(&NVIC_InitStructure);
+#endif
 	
 	//Enable timer2 interrupt
 	NVIC_InitStructure.NVIC_IRQChannel = TIM2_IRQn;
@@ -340,6 +345,12 @@ void DMA_Config(void)
 	DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
 	
 	DMA_Init(DMA1_Channel3, &DMA_InitStructure);
+	
+#ifdef PS2_CAPTURE_DMA
+	//Each TIM1 capture copies the GPIOA input register into the next slot of the keyboard frame.
+	DMA_DeInit(DMA1_Channel2);
+	ps2_dma_setup(0);
+#endif
 }
 
 void USART_Config(void)
@@ -365,6 +376,7 @@ void USART_Config(void)
 
 void EXTI_Config(void)
 {
+#ifndef PS2_CAPTURE_DMA
 	// Enable an interrupt on EXTI line 8 rising
 	EXTI_InitStructure.EXTI_Line		= EXTI_Line8;
 	EXTI_InitStructure.EXTI_Mode		= EXTI_Mode_Interrupt;
@@ -372,10 +384,234 @@ void EXTI_Config(void)
 	EXTI_InitStructure.EXTI_LineCmd	= ENABLE;
 	
 	EXTI_Init(&EXTI_InitStructure);
+#endif
 }
 
+#ifdef PS2_CAPTURE_DMA
+//Check the start, parity and stop bits of a captured frame.  Returns 1 and fills in the scancode if it's good.
+static uint8_t ps2_frame_ok(uint8_t *code)
+{
+	uint8_t i;
+	uint8_t ones = 0;
+	uint8_t data = 0;
+	
+	if (ps2Bits[0] & GPIO_Pin_11)  //start bit must be low
+		return 0;
+	if (!(ps2Bits[PS2_FRAME_BITS-1] & GPIO_Pin_11))  //stop bit must be high
+		return 0;
+	
+	//data comes LSB first, followed by odd parity
+	for (i = 8; i >= 1; i--)
+	{
+		data <<= 1;
+		if (ps2Bits[i] & GPIO_Pin_11)
+		{
+			data |= 1;
+			ones++;
+		}
+	}
+	if (ps2Bits[9] & GPIO_Pin_11)
+		ones++;
+	if (!(ones & 1))
+		return 0;
+	
+	*code = data;
+	return 1;
+}
+
+//Point DMA1 channel 2 at the data line, either sampling it (receive) or driving it (transmit).
+//Uses its own init structure because TIM2_IRQHandler can fire in the middle of this and it owns DMA_InitStructure.
+static void ps2_dma_setup(uint8_t transmit)
+{
+	DMA_InitTypeDef ps2DMA;
+	
+	DMA_Cmd(DMA1_Channel2, DISABLE);
+	
+	ps2DMA.DMA_PeripheralBaseAddr = transmit ? (uint32_t)&GPIOA->BSRR : (uint32_t)&GPIOA->IDR;
+	ps2DMA.DMA_MemoryBaseAddr = (uint32_t)ps2Bits;
+	ps2DMA.DMA_DIR = transmit ? DMA_DIR_PeripheralDST : DMA_DIR_PeripheralSRC;
+	ps2DMA.DMA_BufferSize = PS2_FRAME_BITS;
+	ps2DMA.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	ps2DMA.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	ps2DMA.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+	ps2DMA.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
+	ps2DMA.DMA_Mode = transmit ? DMA_Mode_Normal : DMA_Mode_Circular;
+	ps2DMA.DMA_Priority = DMA_Priority_Low;
+	ps2DMA.DMA_M2M = DMA_M2M_Disable;
+	
+	DMA_Init(DMA1_Channel2, &ps2DMA);
+	DMA_ClearITPendingBit(DMA1_IT_GL2);
+	DMA_ITConfig(DMA1_Channel2, DMA_IT_TC, ENABLE);
+	
+	//don't let a capture from before the switch (like our own clock pull) shift a bit in
+	TIM_ClearFlag(TIM1, TIM_FLAG_CC1);
+	TIM_DMACmd(TIM1, TIM_DMA_CC1, ENABLE);
+	DMA_Cmd(DMA1_Channel2, ENABLE);
+}
+
+//Start sending one byte: hold the clock low for a while, TIM1_UP_IRQHandler does the rest.
+static void ps2_start_byte(uint8_t b)
+{
+	uint8_t i;
+	uint8_t ones = 0;
+	
+	//one BSRR word per falling clock edge: 8 data bits LSB first, odd parity, then let go of the line for the stop and ack bits
+	for (i = 0; i < 8; i++)
+	{
+		if (b & 1)
+		{
+			ps2Bits[i] = GPIO_Pin_11;
+			ones++;
+		}
+		else
+			ps2Bits[i] = GPIO_Pin_11 << 16;
+		b >>= 1;
+	}
+	ps2Bits[8] = (ones & 1) ? GPIO_Pin_11 << 16 : GPIO_Pin_11;
+	ps2Bits[9] = GPIO_Pin_11;
+	ps2Bits[10] = GPIO_Pin_11;
+	
+	ps2State = PS2_INHIBIT;
+	TIM_DMACmd(TIM1, TIM_DMA_CC1, DISABLE);
+	DMA_Cmd(DMA1_Channel2, DISABLE);
+	GPIO_ResetBits(GPIOA, GPIO_Pin_8);
+	
+	TIM_Cmd(TIM1, DISABLE);
+	TIM_SetAutoreload(TIM1, PS2_INHIBIT_TIME);
+	TIM_SetCounter(TIM1, 0);
+	TIM_ClearITPendingBit(TIM1, TIM_IT_Update);
+	TIM_Cmd(TIM1, ENABLE);
+}
+
+//Send the next byte if the bus is free and there's anything to say.  Only ever runs at the keyboard's interrupt priority.
+static void ps2_kick(void)
+{
+	//busy, or the keyboard is partway through a frame of its own
+	if (ps2State != PS2_IDLE || DMA1_Channel2->CNDTR != PS2_FRAME_BITS)
+		return;
+	
+	if (ps2TxPos >= ps2TxLen)
+	{
+		ps2TxPos = 0;
+		if (ps2WantLeds)
+		{
+			ps2WantLeds = 0;
+			ps2TxBytes[0] = 0xED;
+			ps2TxBytes[1] = ps2Leds;
+			ps2TxLen = 2;
+		}
+		else if (ps2WantTypematic)
+		{
+			ps2WantTypematic = 0;
+			ps2TxBytes[0] = 0xF3;
+			ps2TxBytes[1] = ps2Typematic;
+			ps2TxLen = 2;
+		}
+		else
+		{
+			ps2TxLen = 0;
+			return;
+		}
+	}
+	
+	ps2_start_byte(ps2TxBytes[ps2TxPos]);
+}
+
+void DMA1_Channel2_IRQHandler(void)
+{
+	uint32_t start = profile_cycles();
+	uint8_t code;
+	
+	//also pended by hand from ps2_send_pending(), just to run ps2_kick() at this priority
+	if (DMA_GetITStatus(DMA1_IT_TC2) != RESET)
+	{
+		DMA_ClearITPendingBit(DMA1_IT_TC2);
+	
+		if (ps2State == PS2_SENDING)
+		{
+			//Our byte is out.  The keyboard's 0xFA comes back as a normal frame, so listen again,
+			//but leave the timeout clock running in case it never does.
+			ps2_dma_setup(0);
+			ps2State = PS2_WAIT_ACK;
+		}
+		else
+		{
+			if (!ps2_frame_ok(&code))
+				ps2FrameErrors++;
+			else if (ps2State == PS2_WAIT_ACK && (code == 0xFA || code == 0xFE))
+			{
+				if (code == 0xFA)
+					ps2TxPos++;  //on to the next byte. 0xFE means send the same one again.
+				TIM_SetAutoreload(TIM1, PS2_FRAME_TIMEOUT);
+				ps2State = PS2_IDLE;
+			}
+			else if (code == 0xAA && !decode_busy())
+			{
+				//keyboard finished its self test, so it has forgotten everything we told it
+				ps2WantLeds = 1;
+				ps2WantTypematic = 1;
+			}
+			else
+				decode(code);
+	
+			//a whole frame is in; stop the timeout clock so the next start bit restarts it from zero
+			if (ps2State == PS2_IDLE)
+			{
+				TIM_Cmd(TIM1, DISABLE);
+				TIM_SetCounter(TIM1, 0);
+				TIM_ClearITPendingBit(TIM1, TIM_IT_Update);
+			}
+		}
+	}
+	
+	ps2_kick();
+	profile_isr(PROFILE_KEYBOARD, start, 0);
+}
+
+void TIM1_UP_IRQHandler(void)
+{
+	uint32_t start = profile_cycles();
+	
+	TIM_ClearITPendingBit(TIM1, TIM_IT_Update);
+	
+	if (ps2State == PS2_INHIBIT)
+	{
+		//Clock has been held low long enough.  Request to send (data low), let go of the clock,
+		//and let the keyboard clock our bits out of ps2Bits.
+		GPIO_ResetBits(GPIOA, GPIO_Pin_11);
+		ps2_dma_setup(1);
+		TIM_SetAutoreload(TIM1, PS2_SEND_TIMEOUT);
+		TIM_SetCounter(TIM1, 0);
+		TIM_Cmd(TIM1, ENABLE);
+		ps2State = PS2_SENDING;
+		GPIO_SetBits(GPIOA, GPIO_Pin_8);
+		profile_isr(PROFILE_KEYBOARD, start, 0);
+		return;
+	}
+	
+	//A frame started but never finished (noise, or we came up mid-byte), or the keyboard never took or acked our byte.
+	//Give up on it, throw away what we have and wait for a fresh start bit.
+	GPIO_SetBits(GPIOA, GPIO_Pin_8 | GPIO_Pin_11);
+	ps2_dma_setup(0);
+	TIM_SetAutoreload(TIM1, PS2_FRAME_TIMEOUT);
+	ps2TxPos = ps2TxLen;
+	ps2State = PS2_IDLE;
+	ps2FrameErrors++;
+	
+	ps2_kick();
+	profile_isr(PROFILE_KEYBOARD, start, 0);
+}
+
+//Get ps2_kick() to run at the keyboard's priority so it never races the interrupt handlers.
+static void ps2_send_pending(void)
+{
+	NVIC_SetPendingIRQ(DMA1_Channel2_IRQn);
+}
+#else
 void EXTI9_5_IRQHandler(void)
 {
+	uint32_t start = profile_cycles();
+	
 	//figure out what the keyboard is sending us
 	EXTI_ClearFlag(EXTI_Line8);
 	--bitcount;
@@ -392,10 +628,40 @@ void EXTI9_5_IRQHandler(void)
 		scancode = 0;
 		bitcount = 11;
 	}
+	profile_isr(PROFILE_KEYBOARD, start, 0);
+}
+
+//Sending needs the capture hardware, so without it the keyboard just keeps its own settings.
+static void ps2_send_pending(void)
+{
+}
+#endif
+
+void ps2_set_typematic(uint8_t typematic)
+{
+	ps2Typematic = typematic;
+	ps2WantTypematic = 1;
+	ps2_send_pending();
+}
+
+//Caps Lock is set from the keyboard's handler and Num Lock from the main loop, so the handler
+//mustn't cut in between reading the lights and writing them back.
+void ps2_set_led(uint8_t led, uint8_t on)
+{
+	__disable_irq();
+	if (on)
+		ps2Leds |= led;
+	else
+		ps2Leds &= ~led;
+	__enable_irq();
+	ps2WantLeds = 1;
+	ps2_send_pending();
 }
 
 void USART1_IRQHandler(void)
 {
+	uint32_t start = profile_cycles();
+	
 	//receive data from the serial port
 	if(USART_GetITStatus(USART1, USART_IT_RXNE) != RESET)
 	{
@@ -403,10 +669,14 @@ void USART1_IRQHandler(void)
 		buf_enqueue(USART_ReceiveData(USART1));
 		USART_ClearFlag(USART1, USART_FLAG_RXNE);
 	}
+	profile_isr(PROFILE_USART, start, 0);
 }
 
 void TIM2_IRQHandler(void)
 {
+	//how long since the compare event, before we do anything else
+	uint32_t start = profile_cycles();
+	uint16_t latency = TIM2->CNT - INTERRUPT_DELAY;
 	
 	//here's where the ntsc video drawing magic happens!
 	TIM_ClearITPendingBit(TIM2, TIM_IT_CC1);
@@ -439,7 +709,11 @@ void TIM2_IRQHandler(void)
 	{
 		TIM_SetCompare2(TIM2, 342);
 		lineCount = 0;
+		frameCount++;
+		trace_frame(frameCount);
 	}
+	
+	profile_isr(PROFILE_VIDEO, start, latency);
 }
 
 
@@ -474,122 +748,6 @@ void fillFrameBuffer(void)
 	}
 }
 
-//Decode PS/2 keycodes
-void decode(uint8_t code)
-{
-	if (code == 0xF0)
-		keyup = 1;
-	else if (code == 0xE0 || code == 0xE1)
-		extended = 1;
-	else
-	{
-		if (keyup) // handling a key release; don't do anything
-		{
-			if (code == 0x12) // left shift
-				mods &= ~_BV(0);
-			else if (code == 0x59) // right shift
-				mods &= ~_BV(1);
-			else if (code == 0x14) // left/right ctrl
-				mods &= (extended) ? ~_BV(3) : ~_BV(2);
-		}
-		else // handling a key press; store character
-		{
-			if (code == 0x12) // left shift
-				mods |= _BV(0);
-			else if (code == 0x59) // right shift
-				mods |= _BV(1);
-			else if (code == 0x14) // left/right ctrl
-				mods |= (extended) ? _BV(3) : _BV(2);
-			else if (code <= 0x83)
-			{
-				uint8_t chr;
-				if (extended)
-					chr = codetable_extended[code];
-				else if (mods & 0b1100) // ctrl
-					chr = codetable[code] & 31;
-				else if (mods & 0b0011) // shift
-					chr = codetable_shifted[code];
-				else
-					chr = codetable[code];
-				
-				if (!chr) chr = '?';
-				
-				// add to buffer
-				if (charbufsize < MAX_KEY_BUF)
-				{
-					charbuf[charbuftail] = chr;
-					if (++charbuftail >= MAX_KEY_BUF) charbuftail = 0;
-					charbufsize++;
-				}
-			}
-		}
-		extended = 0;
-		keyup = 0;
-	}
-}
-
-/*********Key and serial buffer stuff.  Needs to be updated to support atomic writing (if possible without messing up screen drawing, the sizes get mismatched easily******/
-uint8_t buffer_get_key()
-{
-	if (charbufsize == 0)
-		return 0;
-	
-	uint8_t newchar = charbuf[charbufhead];
-	if (++charbufhead >= MAX_KEY_BUF) charbufhead = 0;
-	charbufsize--;
-	
-	return newchar;
-}
-
-uint8_t key_buf_size()
-{
-	uint8_t sz;
-	sz = charbufsize;
-	return sz;
-}
-
-
-void buf_clear()
-{
-	bufsize = bufhead = buftail = 0;
-}
-
-void buf_enqueue(uint8_t c)
-{
-	if (1) //bufsize < MAX_BUF)
-	{
-		buf[buftail] = c;
-		if (++buftail >= MAX_BUF) buftail = 0;
-		bufsize++;
-	}
-}
-
-uint8_t buf_dequeue()
-{
-	uint8_t ret = 0;
-	if (1) //bufsize > 0)
-	{
-		uint8_t c = buf[bufhead];
-		if (++bufhead >= MAX_BUF) bufhead = 0;
-		bufsize--;
-		ret = c;
-	}
-	return ret;
-}
-
-uint8_t buf_size()
-{
-	uint8_t sz;
-	sz = bufsize;
-	return sz;
-}
-
-
-/*************End of key and serial buffer stuff********************/
-
-
-
-
 //hack hack hack hack copypaste hack hack hack yuck
 void overclockSystemInit(void)
 {
@@ -22,8 +22,32 @@
 #define BUFFER_LINE_LENGTH         31  //Yes, in 16 bit halfwords.
 #define BUFFER_VERT_SIZE           240
 
+//Timer stuf to generate sync and video display.  Need to tweak these if doing a PAL port.
+#define TIMER_PERIOD 5083
+#define INTERRUPT_DELAY 700
+
+#define CPU_MHZ 80  //what RCC_Config sets the core clock to, for turning cycle counts into time
+
 #define _BV(bit) (1 << (bit))  //Useful macro to ease the transition from using avrlibc.
 
+//PS/2 receive method.  With this defined, the keyboard clock on PA8 (TIM1 channel 1) triggers a DMA sample of
+//the data line on PA11 at every falling edge, so we only take one interrupt per scancode instead of eleven.
+//Comment it out to go back to the pin change interrupt on EXTI line 8.
+#define PS2_CAPTURE_DMA
+
+#define PS2_FRAME_BITS             11  //start, 8 data, parity, stop
+#define PS2_FRAME_TIMEOUT          2000  //microseconds. A whole frame takes ~1.1ms at the slowest legal clock.
+#define PS2_INHIBIT_TIME           120   //microseconds to hold the clock low before sending to the keyboard (at least 100)
+#define PS2_SEND_TIMEOUT           20000 //microseconds for the keyboard to clock out and ack a byte from us (it gets 15ms to start)
+
+//Keyboard LEDs, for ps2_set_led()
+#define PS2_LED_SCROLL             0x01
+#define PS2_LED_NUM                0x02
+#define PS2_LED_CAPS               0x04
+
+//Typematic byte for ps2_set_typematic(): repeat delay in bits 5-6, repeat rate in bits 0-4 (0x00 is 30 cps, 0x1F is 2 cps)
+#define PS2_TYPEMATIC_DEFAULT      0x2B  //what keyboards power up with: 500ms, 10.9 cps
+
 //Peripheral init structures.  Extern'd in case the main program needs to mess with them.
 extern GPIO_InitTypeDef			GPIO_InitStructure;
 extern TIM_TimeBaseInitTypeDef		TIM_TimeBaseStructure;
@@ -33,6 +57,7 @@ extern SPI_InitTypeDef				SPI_InitStructure;
 extern DMA_InitTypeDef				DMA_InitStructure;
 extern USART_InitTypeDef			USART_InitStructure;
 extern EXTI_InitTypeDef			EXTI_InitStructure;
+extern TIM_ICInitTypeDef			TIM_ICInitStructure;
 
 //Set everything up
 void thinnerClientSetup(void);
@@ -46,6 +71,14 @@ void waitForVsync(void);
 //Write junk to the framebuffer for debug purposes.
 void fillFrameBuffer(void);
 
+//Tell the keyboard things.  These return right away; the bytes go out from the keyboard interrupts when the bus is free.
+void ps2_set_typematic(uint8_t typematic);
+void ps2_set_led(uint8_t led, uint8_t on);
+
+//Turn PS/2 scancodes into keys in the key buffer.  decode_busy() is true in the middle of a multi-byte code.
+void decode(uint8_t code);
+uint8_t decode_busy(void);
+
 //key buffer stuff
 uint8_t key_buf_size(void);
 uint8_t buffer_get_key(void);
@@ -62,6 +95,13 @@ extern uint16_t frameBuffer[BUFFER_VERT_SIZE][BUFFER_LINE_LENGTH];
 extern volatile uint8_t bufhead;
 extern volatile uint8_t buftail;
 
+//Throughput counters for the status line
+extern volatile uint32_t rxBytes;		//bytes received, including dropped ones
+extern volatile uint8_t bufHighWater;	//fullest the serial buffer has been
+extern volatile uint16_t bufOverruns;	//bytes dropped because the serial buffer was full
+extern volatile uint16_t frameCount;	//video frames sent
+extern volatile uint32_t keyLatencyMax;	//most cycles a key has waited in the key buffer
+
 #endif
 
 
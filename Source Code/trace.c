@@ -0,0 +1,64 @@
+/*
+ * trace.c
+ *
+ * Event trace buffer, see trace.h
+ *
+ * (c) Massachusetts Institute of Technology 2010
+ * Permission granted for experimental and personal use;
+ * license for commercial sale available from MIT.
+ */
+
+#include "trace.h"
+#include "profile.h"
+#include "thinnerclient.h"
+
+#include <stdint.h>
+
+#ifdef TRACE
+traceevent_t traceBuf[TRACE_EVENTS];
+uint16_t traceCount = TRACE_EVENTS;
+static volatile uint8_t traceArmed = 1;
+
+void trace_frame(uint16_t frame)
+{
+  if (traceArmed)
+  {
+    traceArmed = 0;
+    traceCount = 0;
+  }
+  trace(TRACE_FRAME, frame);
+}
+
+void trace_report(void)
+{
+  uint16_t n = traceCount;
+  uint16_t i;
+
+  /* a capture that is still going gets cut off at n; anything added while we print is thrown away */
+  profile_puts("\r\ntrace begin ");
+  profile_putnum(CPU_MHZ);
+  profile_putnum(n);
+  profile_puts("\r\n");
+  for (i = 0; i < n; i++)
+  {
+    profile_putnum(traceBuf[i].id);
+    profile_putnum(traceBuf[i].arg);
+    profile_putnum(traceBuf[i].cycles);
+    profile_puts("\r\n");
+  }
+  profile_puts("trace end\r\n");
+
+  traceCount = TRACE_EVENTS;
+  traceArmed = 1;
+}
+#else
+void trace_frame(uint16_t frame)
+{
+  (void)frame;
+}
+
+void trace_report(void)
+{
+  profile_puts("\r\ntrace not built in, see trace.h\r\n");
+}
+#endif
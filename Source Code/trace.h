@@ -0,0 +1,99 @@
+/*
+ * trace.h
+ *
+ * A timeline of what the interrupt handlers and the main loop were doing, for when the
+ * totals in profile.h aren't enough to tell who is getting in whose way.
+ *
+ * Events are 8 bytes: an id, a 16 bit argument and the DWT cycle count.  Capture starts at
+ * the top of a video frame and stops when the buffer is full; until then recording an event
+ * is a compare and a few stores, and after that it is just the compare.
+ * Send ESC [ 201 n to get the events back over the serial port (one per line, in decimal)
+ * and start a new capture.  trace2json.py turns a log of that into a Chrome trace
+ * (chrome://tracing or ui.perfetto.dev).
+ *
+ * (c) Massachusetts Institute of Technology 2010
+ * Permission granted for experimental and personal use;
+ * license for commercial sale available from MIT.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "profile.h"
+#include <stdint.h>
+
+/* Uncomment to build the trace points in.  The buffer takes TRACE_EVENTS*8 bytes of RAM,
+ * which the normal build doesn't have spare; see the README about moving the font to flash. */
+//#define TRACE
+#define TRACE_EVENTS 128
+
+/* Event ids.  The ISR ones are TRACE_ISR_IN/OUT + 2*PROFILE_xxx.  Keep trace2json.py in step. */
+enum
+{
+  TRACE_ISR_IN,         /* arg: video latency in cycles, otherwise 0 */
+  TRACE_ISR_OUT,
+  TRACE_FRAME = 2*PROFILE_NUM_ISRS,   /* arg: frame number */
+  TRACE_ENQUEUE,        /* arg: serial byte received */
+  TRACE_DEQUEUE,        /* arg: serial byte handed to the terminal */
+  TRACE_KEY,            /* arg: key put in the key buffer */
+  TRACE_RENDER_START,
+  TRACE_RENDER_END
+};
+
+typedef struct
+{
+  uint32_t cycles;
+  uint16_t arg;
+  uint8_t id;
+} traceevent_t;
+
+#ifdef TRACE
+extern traceevent_t traceBuf[TRACE_EVENTS];
+extern uint16_t traceCount;   /* TRACE_EVENTS when not capturing */
+
+/* Record an event that happened at cycle count cycles.  Safe from any priority: the slot is
+ * claimed with ldrex/strex, so a handler that cuts in gets the next one. */
+static __INLINE void trace_at(uint8_t id, uint32_t cycles, uint16_t arg)
+{
+  uint16_t i;
+
+  if (traceCount >= TRACE_EVENTS)
+    return;
+  do
+  {
+    i = __LDREXH(&traceCount);
+    if (i >= TRACE_EVENTS)
+    {
+      __CLREX();
+      return;
+    }
+  } while (__STREXH(i+1, &traceCount));
+
+  traceBuf[i].cycles = cycles;
+  traceBuf[i].arg = arg;
+  traceBuf[i].id = id;
+}
+#else
+static __INLINE void trace_at(uint8_t id, uint32_t cycles, uint16_t arg)
+{
+  (void)id; (void)cycles; (void)arg;
+}
+#endif
+
+/* Record an event that is happening now. */
+static __INLINE void trace(uint8_t id, uint16_t arg)
+{
+#ifdef TRACE
+  trace_at(id, profile_cycles(), arg);
+#else
+  (void)id; (void)arg;
+#endif
+}
+
+/* Called by the video interrupt at the top of each frame.  Starts the capture if one is waiting. */
+void trace_frame(uint16_t frame);
+
+/* Send the captured events out of USART1, then wait for the next frame and capture again. */
+void trace_report(void);
+
+#endif
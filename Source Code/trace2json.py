@@ -0,0 +1,79 @@
+#! /usr/bin/env python3
+
+# Turn an event trace from the thinner client (ESC [ 201 n, see trace.h) into Chrome trace JSON.
+# Capture the serial port to a file while asking for the trace, then:
+#   trace2json.py capture.log > trace.json
+# and load trace.json in chrome://tracing or ui.perfetto.dev.  The last trace in the log is used.
+
+import sys, json
+
+# same order as the PROFILE_ enum in profile.h
+isrs = ["video", "usart", "keyboard"]
+
+TRACE_FRAME = 2*len(isrs)
+TRACE_ENQUEUE = TRACE_FRAME + 1
+TRACE_DEQUEUE = TRACE_FRAME + 2
+TRACE_KEY = TRACE_FRAME + 3
+TRACE_RENDER_START = TRACE_FRAME + 4
+TRACE_RENDER_END = TRACE_FRAME + 5
+
+def read_trace(f):
+	mhz, events, inside = 0, [], False
+	for line in f:
+		words = line.split()
+		if words[:2] == ["trace", "begin"]:
+			mhz, events, inside = int(words[2]), [], True
+		elif words[:2] == ["trace", "end"]:
+			inside = False
+		elif inside and len(words) == 3:
+			events.append([int(w) for w in words])
+	return mhz, events
+
+def main():
+	mhz, events = read_trace(open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin)
+	if not events:
+		sys.exit("no trace found")
+
+	# cycle counts are 32 bits; measure everything from the first event, either side of it
+	first = events[0][2]
+	def when(cycles):
+		rel = (cycles - first + 0x80000000) % 0x100000000 - 0x80000000
+		return float(rel) / mhz
+	events.sort(key=lambda e: when(e[2]))
+
+	out = []
+	def add(ph, name, tid, cycles, args=None):
+		e = {"ph": ph, "name": name, "pid": 1, "tid": tid, "ts": when(cycles)}
+		if ph == "i":
+			e["s"] = "t"
+		if args:
+			e["args"] = args
+		out.append(e)
+
+	for tid, name in enumerate(isrs + ["main"]):
+		out.append({"ph": "M", "name": "thread_name", "pid": 1, "tid": tid, "args": {"name": name}})
+	main_tid = len(isrs)
+
+	for eid, arg, cycles in events:
+		if eid < TRACE_FRAME:
+			isr = eid // 2
+			if eid % 2 == 0:
+				add("B", isrs[isr], isr, cycles, {"latency cycles": arg} if isr == 0 else None)
+			else:
+				add("E", isrs[isr], isr, cycles)
+		elif eid == TRACE_FRAME:
+			add("i", "frame %d" % arg, 0, cycles)
+		elif eid == TRACE_ENQUEUE:
+			add("i", "enqueue", 1, cycles, {"byte": arg})
+		elif eid == TRACE_DEQUEUE:
+			add("i", "dequeue", main_tid, cycles, {"byte": arg})
+		elif eid == TRACE_KEY:
+			add("i", "key", 2, cycles, {"key": arg})
+		elif eid == TRACE_RENDER_START:
+			add("B", "render", main_tid, cycles)
+		elif eid == TRACE_RENDER_END:
+			add("E", "render", main_tid, cycles)
+
+	json.dump({"traceEvents": out, "displayTimeUnit": "ns"}, sys.stdout)
+
+main()
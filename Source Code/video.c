@@ -16,6 +16,8 @@
 #include <string.h>
 #include "video.h"
 #include "defs.h"
+#include "profile.h"
+#include "trace.h"
 
 uint8_t tileMap[TILES_HIGH][TILES_WIDE];
 
@@ -30,6 +32,13 @@ static int8_t mbottom;
 /* reverse video */
 static uint8_t revvideo;
 
+/* Lines the terminal can use; the last one is kept back when the status line is on */
+static int8_t rows = TILES_HIGH;
+
+/* How often, and how slowly, the framebuffer gets redrawn (for the status line) */
+uint32_t renderCount;
+uint32_t renderCyclesMax;
+
 static void CURSOR_INVERT() __attribute__((noinline));
 static void CURSOR_INVERT()
 {
@@ -85,6 +94,22 @@ void sprinthex(char *str, uint8_t n)
 	str[2] = ' ';
 }
 
+uint8_t sprintdec(char *str, uint32_t n)
+{
+	char digits[10];
+	uint8_t len = 0;
+	uint8_t i;
+	do
+	{
+		digits[len++] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	for (i = 0; i < len; i++)
+		str[i] = digits[len-1-i];
+	str[len] = '\0';
+	return len;
+}
+
 //fill the tilemap with junk, useful for debugging
 void filltileMap(void)
 {
@@ -108,7 +133,9 @@ void updateFrameBuffer(uint8_t map[][TILES_WIDE], uint8_t font[][FONT_HEIGHT])
 	uint8_t j;
 	uint8_t k;
 	uint32_t l;
+	uint32_t start = profile_cycles();
 	
+	trace_at(TRACE_RENDER_START, start, 0);
 	for(j = 0; j < TILES_HIGH ; j++)
 	{
 		for(k=0;k<8;k++)
@@ -123,19 +150,24 @@ void updateFrameBuffer(uint8_t map[][TILES_WIDE], uint8_t font[][FONT_HEIGHT])
 			frameBuffer[(j+TOP_MARGIN)*FONT_HEIGHT+k][BUFFER_LINE_LENGTH-1]=0;
 		}
 	}
+	
+	renderCount++;
+	l = profile_cycles() - start;
+	if (l > renderCyclesMax) renderCyclesMax = l;
+	trace_at(TRACE_RENDER_END, start + l, 0);
 }
 
 void video_reset_margins()
 {
-  video_set_margins(0, TILES_HIGH-1);
+  video_set_margins(0, rows-1);
 }
 
 void video_set_margins(int8_t top, int8_t bottom)
 {
   /* sanitize input */
   if (top < 0) top = 0;
-  if (bottom >= TILES_HIGH) bottom = TILES_HIGH-1;
-  if (top >= bottom) { top = 0; bottom = TILES_HIGH-1; }
+  if (bottom >= rows) bottom = rows-1;
+  if (top >= bottom) { top = 0; bottom = rows-1; }
 
   mtop = top;
   mbottom = bottom;
@@ -152,6 +184,28 @@ int8_t video_bottom_margin()
   return mbottom;
 }
 
+void video_set_statusline(uint8_t on)
+{
+  rows = (on) ? TILES_HIGH-1 : TILES_HIGH;
+  /* pulls the cursor and margins back out of the status line */
+  video_reset_margins();
+  memset(&tileMap[TILES_HIGH-1], revvideo, TILES_WIDE);
+}
+
+int8_t video_rows()
+{
+  return rows;
+}
+
+void video_statusline(const char *str)
+{
+  uint8_t i;
+  if (rows == TILES_HIGH) return;
+  /* drawn in the opposite sense to the rest of the screen so it stands out */
+  for (i = 0; i < TILES_WIDE; i++)
+    tileMap[TILES_HIGH-1][i] = ((*str) ? *str++ : ' ') ^ revvideo ^ 0x80;
+}
+
 void video_set_reverse(uint32_t val)
 {
   revvideo = (val) ? 0x80 : 0;
@@ -269,7 +323,7 @@ void video_gotoxy(int8_t x, int8_t y)
   if (cx >= TILES_WIDE) cx = TILES_WIDE-1;
   cy = y;
   if (cy < 0) cy = 0;
-  if (cy >= TILES_HIGH) cy = TILES_HIGH-1;
+  if (cy >= rows) cy = rows-1;
   CURSOR_INVERT();
 }
 
@@ -380,7 +434,7 @@ void video_clrscr()
 {
   CURSOR_INVERT();
   video_reset_margins(); 
-  memset(tileMap, revvideo, TILES_WIDE*TILES_HIGH);
+  memset(tileMap, revvideo, TILES_WIDE*rows);
   cx = cy = 0;
   CURSOR_INVERT();
 }
@@ -405,13 +459,13 @@ void video_erase(uint8_t erasemode)
   {
     case 0: /* erase from cursor to end of screen */
       memset(&tileMap[cy][cx], revvideo,
-          (TILES_WIDE*TILES_HIGH)-(cy*TILES_WIDE+cx));
+          (TILES_WIDE*rows)-(cy*TILES_WIDE+cx));
       break;
     case 1: /* erase from beginning of screen to cursor */
       memset(tileMap, revvideo, cy*TILES_WIDE+cx+1);
       break;
     case 2: /* erase entire screen */
-      memset(tileMap, revvideo, TILES_WIDE*TILES_HIGH);
+      memset(tileMap, revvideo, TILES_WIDE*rows);
       break;
   }
   CURSOR_INVERT();
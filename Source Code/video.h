@@ -24,6 +24,10 @@
 
 extern uint8_t tileMap[TILES_HIGH][TILES_WIDE];
 
+/* Number of updateFrameBuffer() calls, and the most cycles one has taken */
+extern uint32_t renderCount;
+extern uint32_t renderCyclesMax;
+
 void video_setup();
 
 /****** Output routines ******/
@@ -41,6 +45,9 @@ void puthex(uint8_t n);
 
 void sprinthex(char *str, uint8_t n);
 
+/* Writes n in decimal to str, null terminated. Returns the number of digits. */
+uint8_t sprintdec(char *str, uint32_t n);
+
 /* Set the top and bottom margins. The cursor is moved to the first column
  * of the top margin. */
 void video_set_margins(int8_t top, int8_t bottom);
@@ -55,6 +62,17 @@ int8_t video_top_margin();
 /* Returns the line number of the bottom margin. */
 int8_t video_bottom_margin();
 
+/* Keeps the bottom line of the screen for video_statusline() (on = 1) or
+ * gives it back to the terminal (on = 0). Resets the margins. */
+void video_set_statusline(uint8_t on);
+
+/* Returns the number of lines the terminal can use. */
+int8_t video_rows();
+
+/* Writes str across the status line, padded with spaces. Does nothing if
+ * the status line is off. */
+void video_statusline(const char *str);
+
 /* Sets whether or not the screen should be displayed in reverse video. */
 void video_set_reverse(uint32_t val);
 
@@ -0,0 +1,161 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+#include "xvsmfbg.h"
+#include "capture.h"
+
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+// How much each new measurement of the link rate counts for.
+#define RATE_WEIGHT 0.25
+
+double now( void ) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Eight bytes at a time; it only has to notice changes, not stand up to anyone.
+uint64_t hash_bytes( const unsigned char* data, size_t length ) {
+	uint64_t h = 14695981039346656037ull, word;
+	size_t ii = 0;
+
+	for (; ii + 8 <= length; ii += 8) {
+		memcpy(&word, data + ii, 8);
+		h = (h ^ word) * 1099511628211ull;
+		h ^= h >> 29;
+	}
+	for (; ii < length; ii++)
+		h = (h ^ data[ii]) * 1099511628211ull;
+	return h;
+}
+
+void watch_init( screen_watch& watch, const screen_area& area ) {
+	watch.area = area;
+	watch.rows.assign(area_rows(area) + 1, 0);
+	watch.primed = false;
+}
+
+int screen_changes( const unsigned char* buffer, const xwd_info& xwd, screen_watch& watch ) {
+	const screen_area& area = watch.area;
+	int height = watch.rows.size() - 1;
+	int width = area.scale || area.width < OUTPUT_WIDTH ? area.width : OUTPUT_WIDTH;
+	const unsigned char* origin = buffer + xwd.pixel_offset + (size_t) area.y * xwd.bytes_per_line + (size_t) area.x * xwd.bits_per_pixel / 8;
+	size_t row_bytes = (size_t) width * xwd.bits_per_pixel / 8;
+	int changed = 0;
+
+	for (int y = 0; y < height; y++) {
+		uint64_t h = hash_bytes(origin + (size_t) y * xwd.bytes_per_line, row_bytes);
+		changed += h != watch.rows[y];
+		watch.rows[y] = h;
+	}
+
+	uint64_t h = hash_bytes(buffer + xwd.header_size, (size_t) xwd.ncolors * XWD_COLOR_SIZE);
+	changed += h != watch.rows[height];
+	watch.rows[height] = h;
+
+	if (!watch.primed) {
+		watch.primed = true;
+		return height + 1;
+	}
+	return changed;
+}
+
+void pacer_init( link_pacer& pacer, int fd, double rate ) {
+	struct stat st;
+	int queued;
+
+	pacer.fd = fd;
+	pacer.rate = rate;
+	pacer.queued = pacer.written = 0;
+	pacer.last = now();
+
+	// FIONREAD counts what's in a pipe from either end; ttys and sockets report their output queue with TIOCOUTQ.
+	pacer.query = 0;
+	if (fstat(fd, &st) == 0) {
+		if (S_ISFIFO(st.st_mode))
+			pacer.query = FIONREAD;
+		else if (isatty(fd) || S_ISSOCK(st.st_mode))
+			pacer.query = TIOCOUTQ;
+	}
+	if (pacer.query && ioctl(fd, pacer.query, &queued) == -1)
+		pacer.query = 0;
+}
+
+void pacer_update( link_pacer& pacer, double t ) {
+	double dt = t - pacer.last;
+	int queued;
+
+	if (dt <= 0)
+		return;
+
+	if (!pacer.query || ioctl(pacer.fd, pacer.query, &queued) == -1) {
+		pacer.queued += pacer.written - pacer.rate * dt;
+		if (pacer.queued < 0)
+			pacer.queued = 0;
+	} else {
+		double taken = pacer.queued + pacer.written - queued;
+
+		// If anything is still queued the link was busy all along, and what went is what it can do.
+		// If not, it may have sat idle for some of the time, so all we learn is that it's at least that fast.
+		if (taken > 0 && (queued > 0 || taken / dt > pacer.rate))
+			pacer.rate += RATE_WEIGHT * (taken / dt - pacer.rate);
+		pacer.queued = queued;
+	}
+	pacer.written = 0;
+	pacer.last = t;
+}
+
+bool pacer_ready( const link_pacer& pacer, double lead ) {
+	return pacer.queued + pacer.written <= pacer.rate * lead;
+}
+
+void pacer_wrote( link_pacer& pacer, size_t bytes ) {
+	pacer.written += bytes;
+}
+
+bool credit_open( credit_link& link, const char* path, int window ) {
+	// Read and write, so opening a fifo doesn't wait for the far end, and it never looks closed
+	// while the far end is away.
+	int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1) {
+		cerr << "Can't open " << path << " for credit: ";
+		perror(NULL);
+		return false;
+	}
+	credit_attach(link, fd, window);
+	return true;
+}
+
+void credit_attach( credit_link& link, int fd, int window ) {
+	link.fd = fd;
+	link.window = link.credits = window;
+	link.last = now();
+	link.lost = 0;
+}
+
+void credit_collect( credit_link& link ) {
+	unsigned char got[256];
+	ssize_t n;
+
+	while ((n = read(link.fd, got, sizeof(got))) > 0) {
+		for (ssize_t ii = 0; ii < n; ii++)
+			link.credits += got[ii] == CREDIT_BYTE;
+		link.last = now();
+	}
+	if (link.credits > link.window)
+		link.credits = link.window;
+
+	if (link.credits == link.window)
+		link.last = now();
+	else if (now() - link.last > CREDIT_TIMEOUT) {
+		link.credits = link.window;
+		link.last = now();
+		link.lost++;
+	}
+}
@@ -0,0 +1,79 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+// Deciding when to send: noticing that the screen changed, and judging when the link can take
+// another frame.
+
+#ifndef _XVSMFBG_CAPTURE_
+#define _XVSMFBG_CAPTURE_
+
+#include "convert.h"
+
+#include <stdint.h>
+#include <vector>
+
+double now( void );
+
+// A hash of every row of the area xvsmfbg sends, plus one of the colormap.
+struct screen_watch {
+	screen_area area;
+	std::vector<uint64_t> rows;
+	bool primed;
+};
+
+void watch_init( screen_watch& watch, const screen_area& area );
+
+// Rehashes the area and returns how many rows (counting the colormap as one) differ from last
+// time.  The first call says they all did.
+int screen_changes( const unsigned char* buffer, const xwd_info& xwd, screen_watch& watch );
+
+// How fast whatever is on the other end of the output takes bytes away.
+// For a pipe, socket or tty we can ask the kernel how much is still waiting to go; comparing that
+// with what was written gives the rate whenever the link was busy the whole time.  Anything else
+// (a file, say) is assumed to go at the rate we started with.
+struct link_pacer {
+	int fd;
+	int query;        // the ioctl that reports what's queued, or 0
+	double rate;      // bytes a second
+	double queued;    // bytes written but not yet taken, as of last
+	double written;   // bytes written since last
+	double last;
+};
+
+void pacer_init( link_pacer& pacer, int fd, double rate );
+
+// Brings queued and rate up to date.
+void pacer_update( link_pacer& pacer, double t );
+
+// Whether what's queued will be gone within lead seconds, so a frame written now goes straight out after it.
+bool pacer_ready( const link_pacer& pacer, double lead );
+
+void pacer_wrote( link_pacer& pacer, size_t bytes );
+
+// Credit from the far end: it sends back one CREDIT_BYTE for every row it has taken, and we
+// never have more than window rows out that it hasn't.  Credit that doesn't come back within
+// CREDIT_TIMEOUT seconds (the far end restarted, say) is taken as lost, and the window refilled.
+#define CREDIT_BYTE    0x06
+#define CREDIT_TIMEOUT 1.0
+
+struct credit_link {
+	int fd;
+	int window;
+	int credits;      // rows we may send
+	double last;      // when credit last came back, or we last had all of it
+	long lost;        // times we gave up waiting
+};
+
+// Opens the fifo (or whatever) the far end sends credit down.  Returns false, having said why, if it can't.
+bool credit_open( credit_link& link, const char* path, int window );
+
+// Or takes it from an fd we already have, the serial port say.  The fd must be non-blocking.
+void credit_attach( credit_link& link, int fd, int window );
+
+// Collects whatever credit has come back, without waiting; poll link.fd for that.
+void credit_collect( credit_link& link );
+
+#endif
@@ -0,0 +1,290 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+// convbench: how fast xvsmfbg's conversion kernels go.
+//
+//	make convbench && ./convbench
+//
+// Times convert_frame() on a synthetic 480x240 screen at each depth, then every packing kernel
+// this CPU supports on a frame of luminance.  Rates are GB/s of input consumed: screen bytes for
+// the first, luminance bytes for the second.  The check column is a hash of the output; packing
+// kernels that disagree with the scalar one are marked.
+//
+// Then shrinking bigger screens (at depth 24) down to 480x240: 2:1 through each halving kernel,
+// which should all agree with each other and with the general filter, and 8:3 through the general
+// one.  Rates are GB/s of screen consumed.
+//
+// Then each dithering mode, with the packing kernel xvsmfbg would pick, on a smooth gradient.
+// "flips" is how many bytes of output change when a 4x4 block in the middle of the screen gets a
+// little brighter: what a change-only protocol would have to send for it.
+
+#include "xvsmfbg.h"
+#include "convert.h"
+
+#include <stdint.h>
+
+#define MIN_SECONDS 0.5  // run each one for at least this long
+
+double now( void ) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint32_t seed = 1;
+
+unsigned char rnd( void ) {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+uint32_t frame_hash( const unsigned char* data, size_t length ) {
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	for (size_t ii = 0; ii < length; ii++)
+		h = (h ^ data[ii]) * 16777619u;
+	return h;
+}
+
+void put32( unsigned char* p, unsigned long v ) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+// An XWD like Xvfb's at the given depth and size, full of noise.
+unsigned char* make_screen( int bpp, int width, int height, size_t* size ) {
+	bool colormapped = bpp == 8;
+	int ncolors = colormapped ? 256 : 0;
+	int bytes_per_line = width * bpp / 8;
+	size_t offset = XWD_HEADER_FIELDS * 4 + ncolors * XWD_COLOR_SIZE;
+	unsigned long masks[3] = { 0, 0, 0 };
+
+	if (bpp == 16) {
+		masks[0] = 0xF800;
+		masks[1] = 0x07E0;
+		masks[2] = 0x001F;
+	} else if (bpp > 16) {
+		masks[0] = 0xFF0000;
+		masks[1] = 0x00FF00;
+		masks[2] = 0x0000FF;
+	}
+
+	*size = offset + (size_t) bytes_per_line * height;
+	unsigned char* screen = (unsigned char*) calloc(*size, 1);
+	unsigned long fields[XWD_HEADER_FIELDS] = {
+		offset - ncolors * XWD_COLOR_SIZE, XWD_FILE_VERSION, XWD_ZPIXMAP, (unsigned long) bpp, (unsigned long) width, (unsigned long) height,
+		0, 0, 32, 0, 32, (unsigned long) bpp, (unsigned long) bytes_per_line, colormapped ? 3ul : XWD_TRUE_COLOR, masks[0], masks[1], masks[2],
+		8, (unsigned long) ncolors, (unsigned long) ncolors, (unsigned long) width, (unsigned long) height, 0, 0, 0
+	};
+	for (int ii = 0; ii < XWD_HEADER_FIELDS; ii++)
+		put32(screen + ii*4, fields[ii]);
+
+	// a grey colormap
+	for (int ii = 0; ii < ncolors; ii++) {
+		unsigned char* color = screen + XWD_HEADER_FIELDS * 4 + ii * XWD_COLOR_SIZE;
+		put32(color, ii);
+		for (int jj = 0; jj < 3; jj++) {
+			color[4 + jj*2] = ii;
+			color[5 + jj*2] = ii;
+		}
+	}
+	for (size_t ii = offset; ii < *size; ii++)
+		screen[ii] = rnd();
+	return screen;
+}
+
+// Times convert_frame() on the whole screen, through the given halving kernel if it's 2:1.
+// Returns the hash of what it made.
+uint32_t time_convert( const char* what, const unsigned char* screen, const xwd_info& xwd, area_filter& filter, unsigned char* lum ) {
+	static lum_tables tables;
+	long frames = 0;
+	double start, elapsed;
+
+	if (xwd.visual_class >= XWD_TRUE_COLOR)
+		build_truecolor_tables(xwd, tables);
+	convert_row_fn convert_row = pick_kernel(xwd);
+
+	start = now();
+	do {
+		convert_frame(screen, xwd, convert_row, tables, filter, lum);
+		frames++;
+	} while ((elapsed = now() - start) < MIN_SECONDS);
+
+	uint32_t check = frame_hash(lum, OUTPUT_WIDTH * OUTPUT_HEIGHT);
+	printf("%-24s %8.1f us/frame %7.3f GB/s  check %08x\n", what, elapsed / frames * 1e6,
+		(double) xwd.bytes_per_line * filter.area.height * frames / elapsed / 1e9, check);
+	return check;
+}
+
+unsigned char* screen_of( int bpp, int width, int height, xwd_info& xwd ) {
+	size_t size;
+	unsigned char* screen = make_screen(bpp, width, height, &size);
+
+	if (!parse_xwd(screen, size, xwd))
+		exit(1);
+	return screen;
+}
+
+void whole_screen( area_filter& filter, const xwd_info& xwd, bool scale ) {
+	screen_area area = { 0, 0, 0, 0, scale };
+	fit_area(area, xwd);
+	build_filter(filter, area);
+}
+
+void bench_convert( int bpp, unsigned char* lum ) {
+	xwd_info xwd;
+	unsigned char* screen = screen_of(bpp, OUTPUT_WIDTH, OUTPUT_HEIGHT, xwd);
+	area_filter filter;
+	char what[32];
+
+	whole_screen(filter, xwd, false);
+	snprintf(what, sizeof(what), "convert %d bpp", bpp);
+	time_convert(what, screen, xwd, filter, lum);
+	free(screen);
+}
+
+bool bench_shrink( unsigned char* lum ) {
+	xwd_info xwd;
+	unsigned char* screen = screen_of(32, 2 * OUTPUT_WIDTH, 2 * OUTPUT_HEIGHT, xwd);
+	area_filter filter;
+	char what[32];
+	bool ok = true;
+
+	// The general filter's weights for 2:1 are all 128, which comes out exactly the same.
+	whole_screen(filter, xwd, true);
+	filter.half = false;
+	uint32_t expect = time_convert("shrink 2:1 filter", screen, xwd, filter, lum);
+	filter.half = true;
+	for (int ii = 0; ii < num_half_kernels; ii++) {
+		if (!half_kernels[ii].supported()) {
+			printf("shrink 2:1 %-13s not supported here\n", half_kernels[ii].name);
+			continue;
+		}
+		filter.halve = &half_kernels[ii];
+		snprintf(what, sizeof(what), "shrink 2:1 %s", half_kernels[ii].name);
+		if (time_convert(what, screen, xwd, filter, lum) != expect) {
+			printf("shrink 2:1 %-13s disagrees with the filter\n", half_kernels[ii].name);
+			ok = false;
+		}
+	}
+	free(screen);
+
+	screen = screen_of(32, 1280, 640, xwd);
+	whole_screen(filter, xwd, true);
+	time_convert("shrink 8:3 filter", screen, xwd, filter, lum);
+	free(screen);
+	return ok;
+}
+
+void bench_pack( const pack_kernel* kernel, const unsigned char* lum, uint32_t expect ) {
+	static unsigned char out[OUTPUT_WIDTH * OUTPUT_HEIGHT / 8];
+	long frames = 0;
+	double start, elapsed;
+
+	start = now();
+	do {
+		pack_frame(kernel, lum, out, 128);
+		frames++;
+	} while ((elapsed = now() - start) < MIN_SECONDS);
+
+	uint32_t check = frame_hash(out, sizeof(out));
+	printf("pack %-10s  %8.1f us/frame %7.3f GB/s  check %08x%s\n", kernel->name, elapsed / frames * 1e6,
+		(double) OUTPUT_WIDTH * OUTPUT_HEIGHT * frames / elapsed / 1e9, check, check == expect ? "" : "  MISMATCH");
+}
+
+// Every kernel against the scalar one, at every threshold, so the edge cases get a look too.
+bool check_pack( const pack_kernel* kernel, const unsigned char* lum ) {
+	static unsigned char want[OUTPUT_WIDTH * OUTPUT_HEIGHT / 8], got[OUTPUT_WIDTH * OUTPUT_HEIGHT / 8];
+	const pack_kernel* scalar = &pack_kernels[num_pack_kernels - 1];
+
+	for (int threshold = 0; threshold < 256; threshold++) {
+		pack_frame(scalar, lum, want, threshold);
+		pack_frame(kernel, lum, got, threshold);
+		if (memcmp(want, got, sizeof(want))) {
+			printf("pack %-10s  disagrees with %s at threshold %d\n", kernel->name, scalar->name, threshold);
+			return false;
+		}
+	}
+	return true;
+}
+
+void bench_dither( int mode, const pack_kernel* kernel, const unsigned char* lum ) {
+	static unsigned char out[OUTPUT_WIDTH * OUTPUT_HEIGHT / 8], moved[OUTPUT_WIDTH * OUTPUT_HEIGHT / 8];
+	static unsigned char nudged[OUTPUT_WIDTH * OUTPUT_HEIGHT];
+	long frames = 0;
+	double start, elapsed;
+
+	start = now();
+	do {
+		dither_frame(mode, kernel, lum, out);
+		frames++;
+	} while ((elapsed = now() - start) < MIN_SECONDS);
+
+	memcpy(nudged, lum, sizeof(nudged));
+	for (int y = OUTPUT_HEIGHT/2; y < OUTPUT_HEIGHT/2 + 4; y++)
+		for (int x = OUTPUT_WIDTH/2; x < OUTPUT_WIDTH/2 + 4; x++)
+			nudged[y * OUTPUT_WIDTH + x] += 16;
+	dither_frame(mode, kernel, nudged, moved);
+	int flips = 0;
+	for (size_t ii = 0; ii < sizeof(out); ii++)
+		flips += out[ii] != moved[ii];
+
+	printf("dither %-15s %8.1f us/frame %7.3f GB/s  check %08x  flips %d\n", dither_names[mode], elapsed / frames * 1e6,
+		(double) OUTPUT_WIDTH * OUTPUT_HEIGHT * frames / elapsed / 1e9, frame_hash(out, sizeof(out)), flips);
+}
+
+// The ordered modes go through the packing kernels too, so check them against scalar as well.
+bool check_dither( const pack_kernel* kernel, const unsigned char* lum ) {
+	static unsigned char want[OUTPUT_WIDTH * OUTPUT_HEIGHT / 8], got[OUTPUT_WIDTH * OUTPUT_HEIGHT / 8];
+	const pack_kernel* scalar = &pack_kernels[num_pack_kernels - 1];
+
+	for (int mode = 0; mode < NUM_DITHER_MODES; mode++) {
+		dither_frame(mode, scalar, lum, want);
+		dither_frame(mode, kernel, lum, got);
+		if (memcmp(want, got, sizeof(want))) {
+			printf("dither %-15s disagrees between %s and %s\n", dither_names[mode], kernel->name, scalar->name);
+			return false;
+		}
+	}
+	return true;
+}
+
+int main( void ) {
+	static unsigned char lum[OUTPUT_WIDTH * OUTPUT_HEIGHT];
+	static unsigned char out[OUTPUT_WIDTH * OUTPUT_HEIGHT / 8];
+	const int depths[] = { 8, 16, 24, 32 };
+	bool ok = true;
+
+	for (int ii = 0; ii < 4; ii++)
+		bench_convert(depths[ii], lum);
+	ok = bench_shrink(lum) && ok;
+
+	for (size_t ii = 0; ii < sizeof(lum); ii++)
+		lum[ii] = rnd();
+	pack_frame(&pack_kernels[num_pack_kernels - 1], lum, out, 128);
+	uint32_t expect = frame_hash(out, sizeof(out));
+
+	for (int ii = 0; ii < num_pack_kernels; ii++) {
+		if (!pack_kernels[ii].supported()) {
+			printf("pack %-10s  not supported here\n", pack_kernels[ii].name);
+			continue;
+		}
+		ok = check_pack(&pack_kernels[ii], lum) && ok;
+		ok = check_dither(&pack_kernels[ii], lum) && ok;
+		bench_pack(&pack_kernels[ii], lum, expect);
+	}
+
+	// a diagonal gradient, black at the top left
+	for (int y = 0; y < OUTPUT_HEIGHT; y++)
+		for (int x = 0; x < OUTPUT_WIDTH; x++)
+			lum[y * OUTPUT_WIDTH + x] = (x + 2*y) * 255 / (OUTPUT_WIDTH + 2*OUTPUT_HEIGHT);
+	const pack_kernel* pack = pick_pack_kernel();
+	for (int mode = 0; mode < NUM_DITHER_MODES; mode++)
+		bench_dither(mode, pack, lum);
+	return ok ? 0 : 1;
+}
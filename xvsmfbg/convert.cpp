@@ -0,0 +1,587 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+#include "xvsmfbg.h"
+#include "convert.h"
+
+#include <algorithm>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PACK_X86
+#endif
+
+unsigned long read32( const unsigned char* p, bool swap ) {
+	if (swap)
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long) p[3] << 24);
+	return ((unsigned long) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+unsigned int read16( const unsigned char* p, bool swap ) {
+	return swap ? (p[0] | (p[1] << 8)) : ((p[0] << 8) | p[1]);
+}
+
+// Reads the XWD header at the start of the shared memory.  Returns false, having said why, if we can't use it.
+bool parse_xwd( const unsigned char* buffer, size_t size, xwd_info& xwd ) {
+	unsigned long field[XWD_HEADER_FIELDS];
+
+	if (size < XWD_HEADER_FIELDS * 4) {
+		cerr << "Shared memory is too small to hold an XWD header." << endl;
+		return false;
+	}
+
+	// XWD files are meant to be big endian, but Xvfb writes its header the way the machine it runs on likes.
+	xwd.swap = read32(buffer + 4, false) != XWD_FILE_VERSION;
+	for (int ii = 0; ii < XWD_HEADER_FIELDS; ii++)
+		field[ii] = read32(buffer + ii*4, xwd.swap);
+
+	if (field[1] != XWD_FILE_VERSION) {
+		cerr << "Not an XWD header (file version " << field[1] << ")." << endl;
+		return false;
+	}
+	if (field[2] != XWD_ZPIXMAP) {
+		cerr << "Only ZPixmap XWD images are supported (format " << field[2] << ")." << endl;
+		return false;
+	}
+
+	xwd.header_size    = field[0];
+	xwd.width          = field[4];
+	xwd.height         = field[5];
+	xwd.byte_order     = field[7];
+	xwd.bits_per_pixel = field[11];
+	xwd.bytes_per_line = field[12];
+	xwd.visual_class   = field[13];
+	xwd.red_mask       = field[14];
+	xwd.green_mask     = field[15];
+	xwd.blue_mask      = field[16];
+	xwd.ncolors        = field[19];
+	xwd.pixel_offset   = xwd.header_size + (size_t) xwd.ncolors * XWD_COLOR_SIZE;
+
+	if (xwd.bits_per_pixel != 8 && xwd.bits_per_pixel != 16 && xwd.bits_per_pixel != 24 && xwd.bits_per_pixel != 32) {
+		cerr << "Can't convert " << xwd.bits_per_pixel << " bits per pixel; run Xvfb at depth 8, 16 or 24." << endl;
+		return false;
+	}
+	if (xwd.visual_class >= XWD_TRUE_COLOR ? !(xwd.red_mask | xwd.green_mask | xwd.blue_mask) : xwd.bits_per_pixel != 8) {
+		cerr << "Can't make sense of visual class " << xwd.visual_class << " at " << xwd.bits_per_pixel << " bits per pixel." << endl;
+		return false;
+	}
+	if (xwd.header_size < XWD_HEADER_FIELDS * 4 || xwd.width <= 0 || xwd.height <= 0
+	    || xwd.bytes_per_line < xwd.width * xwd.bits_per_pixel / 8
+	    || xwd.pixel_offset + (size_t) xwd.bytes_per_line * xwd.height > size) {
+		cerr << "XWD header doesn't fit the shared memory it's in." << endl;
+		return false;
+	}
+	return true;
+}
+
+// Tone curve, applied to the luminance as it's worked out: contrast about mid grey, then gamma.
+// A gamma above 1 takes the luminance towards linear light, so dithering lights the right number of pixels.
+unsigned char tone[256];
+
+static struct build_identity_tone {
+	build_identity_tone() {
+		for (int v = 0; v < 256; v++)
+			tone[v] = v;
+	}
+} build_identity_tone_table;
+
+void build_tone_table( double gamma, double contrast ) {
+	for (int v = 0; v < 256; v++) {
+		double t = (v / 255.0 - 0.5) * contrast + 0.5;
+		t = t < 0 ? 0 : t > 1 ? 1 : t;
+		tone[v] = (unsigned char) (pow(t, gamma) * 255 + 0.5);
+	}
+}
+
+// Luminance lookup tables, 0-255.
+// Luminance is a weighted sum of the colour channels, so it's also a sum over the bytes, whatever the masks are.
+// lum8 has the tone curve applied already; the wider kernels look it up on the way out.
+
+int mask_shift( unsigned long mask ) {
+	int shift = 0;
+	while (mask && !(mask & 1)) {
+		mask >>= 1;
+		shift++;
+	}
+	return shift;
+}
+
+void build_truecolor_tables( const xwd_info& xwd, lum_tables& tables ) {
+	int bytes = xwd.bits_per_pixel / 8;
+	int rshift = mask_shift(xwd.red_mask), gshift = mask_shift(xwd.green_mask), bshift = mask_shift(xwd.blue_mask);
+	double rmax = xwd.red_mask >> rshift, gmax = xwd.green_mask >> gshift, bmax = xwd.blue_mask >> bshift;
+
+	for (int pos = 0; pos < bytes; pos++) {
+		int shift = 8 * (xwd.byte_order == XWD_MSB_FIRST ? bytes - 1 - pos : pos);
+		for (int v = 0; v < 256; v++) {
+			unsigned long pixel = (unsigned long) v << shift;
+			double r = rmax ? ((pixel & xwd.red_mask) >> rshift) * 255 / rmax : 0;
+			double g = gmax ? ((pixel & xwd.green_mask) >> gshift) * 255 / gmax : 0;
+			double b = bmax ? ((pixel & xwd.blue_mask) >> bshift) * 255 / bmax : 0;
+			tables.lum_part[pos][v] = (unsigned int) ((0.299*r + 0.587*g + 0.114*b) * 256 + 0.5);
+		}
+	}
+	if (bytes == 1)
+		for (int v = 0; v < 256; v++)
+			tables.lum8[v] = tone[tables.lum_part[0][v] >> 8];
+}
+
+// Applications change the colormap as they go, so this gets redone for every frame.
+void build_colormap_table( const unsigned char* buffer, const xwd_info& xwd, lum_tables& tables ) {
+	const unsigned char* color = buffer + xwd.header_size;
+
+	memset(tables.lum8, 0, sizeof(tables.lum8));
+	for (int ii = 0; ii < xwd.ncolors; ii++, color += XWD_COLOR_SIZE) {
+		unsigned long pixel = read32(color, xwd.swap);
+		unsigned long r = read16(color + 4, xwd.swap), g = read16(color + 6, xwd.swap), b = read16(color + 8, xwd.swap);
+		if (pixel < 256)
+			tables.lum8[pixel] = tone[(299*r + 587*g + 114*b) / 1000 >> 8];
+	}
+}
+
+// Conversion kernels: one row of pixels to one byte of luminance each.
+void convert_row_8( const unsigned char* src, unsigned char* dst, int width, const lum_tables& tables ) {
+	for (int x = 0; x < width; x++)
+		dst[x] = tables.lum8[src[x]];
+}
+
+void convert_row_16( const unsigned char* src, unsigned char* dst, int width, const lum_tables& tables ) {
+	for (int x = 0; x < width; x++, src += 2)
+		dst[x] = tone[(tables.lum_part[0][src[0]] + tables.lum_part[1][src[1]]) >> 8];
+}
+
+void convert_row_24( const unsigned char* src, unsigned char* dst, int width, const lum_tables& tables ) {
+	for (int x = 0; x < width; x++, src += 3)
+		dst[x] = tone[(tables.lum_part[0][src[0]] + tables.lum_part[1][src[1]] + tables.lum_part[2][src[2]]) >> 8];
+}
+
+void convert_row_32( const unsigned char* src, unsigned char* dst, int width, const lum_tables& tables ) {
+	for (int x = 0; x < width; x++, src += 4)
+		dst[x] = tone[(tables.lum_part[0][src[0]] + tables.lum_part[1][src[1]] + tables.lum_part[2][src[2]] + tables.lum_part[3][src[3]]) >> 8];
+}
+
+convert_row_fn pick_kernel( const xwd_info& xwd ) {
+	switch (xwd.bits_per_pixel) {
+		case 8:  return convert_row_8;
+		case 16: return convert_row_16;
+		case 24: return convert_row_24;
+		default: return convert_row_32;
+	}
+}
+
+// Packing kernels.
+// All of them compare each pixel's luminance against the threshold for that pixel and put the first pixel in the top bit.
+
+void pack_row_scalar( const unsigned char* lum, const unsigned char* threshold, unsigned char* out, int width ) {
+	for (int ii = 0; ii < width / 8; ii++) {
+		unsigned char build = 0;
+
+		// Build a byte of output, one bit at a time
+		for (int jj = 0; jj < 8; jj++) {
+			build <<= 1;
+			build |= *lum >= *threshold;
+			lum++;
+			threshold++;
+		}
+		out[ii] = build;
+	}
+}
+
+bool always( void ) {
+	return true;
+}
+
+#ifdef PACK_X86
+// movemask gives the first pixel the bottom bit, so turn each byte round.
+static unsigned char reversed[256];
+
+static struct build_reversed {
+	build_reversed() {
+		for (int ii = 0; ii < 256; ii++)
+			for (int jj = 0; jj < 8; jj++)
+				reversed[ii] |= ((ii >> jj) & 1) << (7 - jj);
+	}
+} build_reversed_table;
+
+bool sse2_supported( void ) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+bool avx2_supported( void ) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+// 16 pixels at a time.  SSE2 only compares signed bytes, so both sides get their top bit flipped first.
+__attribute__((target("sse2")))
+void pack_row_sse2( const unsigned char* lum, const unsigned char* threshold, unsigned char* out, int width ) {
+	const __m128i flip = _mm_set1_epi8((char) 0x80);
+	int x = 0;
+
+	for (; x + 16 <= width; x += 16) {
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (lum + x)), flip);
+		__m128i limit = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (threshold + x)), flip);
+		unsigned int below = _mm_movemask_epi8(_mm_cmpgt_epi8(limit, v));
+		out[x/8]     = reversed[~below & 0xFF];
+		out[x/8 + 1] = reversed[(~below >> 8) & 0xFF];
+	}
+	pack_row_scalar(lum + x, threshold + x, out + x/8, width - x);
+}
+
+// 32 pixels at a time, with each group of 8 turned round before the movemask so the bits come out in order.
+__attribute__((target("avx2")))
+void pack_row_avx2( const unsigned char* lum, const unsigned char* threshold, unsigned char* out, int width ) {
+	const __m256i flip = _mm256_set1_epi8((char) 0x80);
+	const __m256i turn = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+	                                      7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	int x = 0;
+
+	for (; x + 32 <= width; x += 32) {
+		__m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (lum + x)), flip);
+		__m256i limit = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (threshold + x)), flip);
+		__m256i below = _mm256_shuffle_epi8(_mm256_cmpgt_epi8(limit, v), turn);
+		unsigned int bits = ~(unsigned int) _mm256_movemask_epi8(below);
+		memcpy(out + x/8, &bits, 4);  // x86 is little endian, so the first 8 pixels land in the first byte
+	}
+	// The tail goes through the SSE2 kernel, which isn't VEX encoded: clear the upper halves first
+	// or every SSE2 instruction after this pays for the dirty AVX state.
+	_mm256_zeroupper();
+	pack_row_sse2(lum + x, threshold + x, out + x/8, width - x);
+}
+#endif
+
+const pack_kernel pack_kernels[] = {
+#ifdef PACK_X86
+	{ "avx2",   pack_row_avx2,   avx2_supported },
+	{ "sse2",   pack_row_sse2,   sse2_supported },
+#endif
+	{ "scalar", pack_row_scalar, always },
+};
+const int num_pack_kernels = sizeof(pack_kernels) / sizeof(pack_kernels[0]);
+
+const pack_kernel* pick_pack_kernel( void ) {
+	const char* want = getenv("XVSMFBG_PACK");
+
+	for (int ii = 0; ii < num_pack_kernels; ii++) {
+		if (want && strcmp(want, pack_kernels[ii].name))
+			continue;
+		if (pack_kernels[ii].supported())
+			return &pack_kernels[ii];
+	}
+	if (want)
+		cerr << "Packing kernel " << want << " isn't available here, using the fastest one that is." << endl;
+	for (int ii = 0; ii < num_pack_kernels; ii++)
+		if (pack_kernels[ii].supported())
+			return &pack_kernels[ii];
+	return &pack_kernels[num_pack_kernels - 1];
+}
+
+void pack_frame( const pack_kernel* kernel, const unsigned char* lum, unsigned char* out, unsigned char threshold ) {
+	unsigned char row[OUTPUT_WIDTH];
+
+	memset(row, threshold, sizeof(row));
+	for (int y = 0; y < OUTPUT_HEIGHT; y++, lum += OUTPUT_WIDTH, out += OUTPUT_WIDTH/8) {
+		kernel->pack_row(lum, row, out, OUTPUT_WIDTH);
+
+		// For safety, the last pixel of every line must be blanked.
+		out[OUTPUT_WIDTH/8 - 1] &= 0xfe;
+	}
+}
+
+// Screen areas.
+
+bool parse_area( const char* text, screen_area& area ) {
+	char extra;
+
+	area.x = area.y = 0;
+	if (sscanf(text, "%dx%d+%d+%d%c", &area.width, &area.height, &area.x, &area.y, &extra) == 4
+	    || sscanf(text, "%dx%d%c", &area.width, &area.height, &extra) == 2)
+		return area.width >= 0 && area.height >= 0 && area.x >= 0 && area.y >= 0;
+	return false;
+}
+
+bool fit_area( screen_area& area, const xwd_info& xwd ) {
+	if (area.x >= xwd.width || area.y >= xwd.height) {
+		cerr << "The area starts off the " << xwd.width << "x" << xwd.height << " screen." << endl;
+		return false;
+	}
+	if (!area.width)
+		area.width = xwd.width - area.x;
+	if (!area.height)
+		area.height = xwd.height - area.y;
+	if (area.x + area.width > xwd.width || area.y + area.height > xwd.height) {
+		cerr << "The area " << area.width << "x" << area.height << "+" << area.x << "+" << area.y
+		     << " doesn't fit on the " << xwd.width << "x" << xwd.height << " screen." << endl;
+		return false;
+	}
+	return true;
+}
+
+int area_rows( const screen_area& area ) {
+	return area.scale || area.height < OUTPUT_HEIGHT ? area.height : OUTPUT_HEIGHT;
+}
+
+// Shrinking (or stretching) from pixels to sent pixels along one direction.  Measured in units of
+// 1/(from * to) of the whole, pixel j covers [j*to, (j+1)*to) and sent pixel i [i*from, (i+1)*from);
+// each pixel counts for as much of a sent pixel as it covers.
+static void build_taps( filter_taps& taps, int from, int to ) {
+	taps.first.resize(to);
+	taps.count.resize(to);
+	taps.start.resize(to);
+	taps.weight.clear();
+
+	for (int ii = 0; ii < to; ii++) {
+		long lo = (long) ii * from, hi = lo + from;
+		int first = lo / to, last = (hi - 1) / to;
+		int total = 0, biggest = 0;
+
+		taps.first[ii] = first;
+		taps.count[ii] = last - first + 1;
+		taps.start[ii] = taps.weight.size();
+		for (int jj = first; jj <= last; jj++) {
+			long covered = min(hi, (long) (jj + 1) * to) - max(lo, (long) jj * to);
+			int w = (covered * 256 + from / 2) / from;
+			taps.weight.push_back(w);
+			total += w;
+			if (w > taps.weight[taps.start[ii] + biggest])
+				biggest = jj - first;
+		}
+		// Rounding can leave them a little off; the biggest won't notice.
+		taps.weight[taps.start[ii] + biggest] += 256 - total;
+	}
+}
+
+void build_filter( area_filter& filter, const screen_area& area ) {
+	filter.area = area;
+	filter.half = area.scale && area.width == 2 * OUTPUT_WIDTH && area.height == 2 * OUTPUT_HEIGHT;
+	filter.halve = &half_kernels[num_half_kernels - 1];
+	for (int ii = 0; ii < num_half_kernels; ii++) {
+		if (half_kernels[ii].supported()) {
+			filter.halve = &half_kernels[ii];
+			break;
+		}
+	}
+	if (area.scale) {
+		build_taps(filter.across, area.width, OUTPUT_WIDTH);
+		build_taps(filter.down, area.height, OUTPUT_HEIGHT);
+	}
+	filter.row.resize(area.width);
+	filter.row2.resize(area.width);
+	filter.shrunk.resize(OUTPUT_WIDTH);
+	filter.sum.resize(OUTPUT_WIDTH);
+}
+
+void half_row_scalar( const unsigned char* top, const unsigned char* bottom, unsigned char* out, int width ) {
+	for (int x = 0; x < width; x++, top += 2, bottom += 2)
+		out[x] = (top[0] + top[1] + bottom[0] + bottom[1] + 2) >> 2;
+}
+
+#ifdef PACK_X86
+// 16 at a time: the odd and even bytes of each row are added up as 16 bit lanes.
+__attribute__((target("sse2")))
+void half_row_sse2( const unsigned char* top, const unsigned char* bottom, unsigned char* out, int width ) {
+	const __m128i even = _mm_set1_epi16(0x00FF), two = _mm_set1_epi16(2);
+	int x = 0;
+
+	for (; x + 16 <= width; x += 16) {
+		__m128i sums[2];
+		for (int half = 0; half < 2; half++) {
+			__m128i t = _mm_loadu_si128((const __m128i*) (top + 2*x + 16*half));
+			__m128i b = _mm_loadu_si128((const __m128i*) (bottom + 2*x + 16*half));
+			__m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(t, even), _mm_srli_epi16(t, 8)),
+			                            _mm_add_epi16(_mm_and_si128(b, even), _mm_srli_epi16(b, 8)));
+			sums[half] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+		}
+		_mm_storeu_si128((__m128i*) (out + x), _mm_packus_epi16(sums[0], sums[1]));
+	}
+	half_row_scalar(top + 2*x, bottom + 2*x, out + x, width - x);
+}
+#endif
+
+const half_kernel half_kernels[] = {
+#ifdef PACK_X86
+	{ "sse2",   half_row_sse2,   sse2_supported },
+#endif
+	{ "scalar", half_row_scalar, always },
+};
+const int num_half_kernels = sizeof(half_kernels) / sizeof(half_kernels[0]);
+
+// One row of the area, converted and shrunk across, into filter.shrunk.  Two rows sent next to
+// each other share the row between them, so the last one is kept.
+static void shrink_row( const unsigned char* origin, const xwd_info& xwd, convert_row_fn convert_row, const lum_tables& tables, area_filter& filter, int y ) {
+	if (y == filter.shrunk_row)
+		return;
+	convert_row(origin + (size_t) y * xwd.bytes_per_line, &filter.row[0], filter.area.width, tables);
+
+	const filter_taps& taps = filter.across;
+	for (int x = 0; x < OUTPUT_WIDTH; x++) {
+		const unsigned char* src = &filter.row[taps.first[x]];
+		const unsigned short* w = &taps.weight[taps.start[x]];
+		unsigned int sum = 0;
+		for (int k = 0; k < taps.count[x]; k++)
+			sum += src[k] * w[k];
+		filter.shrunk[x] = sum;
+	}
+	filter.shrunk_row = y;
+}
+
+// Turns the area of the screen in the shared memory into OUTPUT_WIDTH x OUTPUT_HEIGHT bytes of luminance.
+void convert_frame( const unsigned char* buffer, const xwd_info& xwd, convert_row_fn convert_row, lum_tables& tables, area_filter& filter, unsigned char* lum ) {
+	const screen_area& area = filter.area;
+	const unsigned char* origin = buffer + xwd.pixel_offset + (size_t) area.y * xwd.bytes_per_line + (size_t) area.x * xwd.bits_per_pixel / 8;
+
+	if (xwd.visual_class < XWD_TRUE_COLOR)
+		build_colormap_table(buffer, xwd, tables);
+
+	if (!area.scale) {
+		int width = area.width < OUTPUT_WIDTH ? area.width : OUTPUT_WIDTH;
+
+		for (int y = 0; y < OUTPUT_HEIGHT; y++, lum += OUTPUT_WIDTH) {
+			if (y < area.height) {
+				convert_row(origin + (size_t) y * xwd.bytes_per_line, lum, width, tables);
+				memset(lum + width, 0, OUTPUT_WIDTH - width);
+			} else {
+				memset(lum, 0, OUTPUT_WIDTH);
+			}
+		}
+		return;
+	}
+
+	if (filter.half) {
+		for (int y = 0; y < OUTPUT_HEIGHT; y++, lum += OUTPUT_WIDTH) {
+			convert_row(origin + (size_t) (2*y) * xwd.bytes_per_line, &filter.row[0], area.width, tables);
+			convert_row(origin + (size_t) (2*y + 1) * xwd.bytes_per_line, &filter.row2[0], area.width, tables);
+			filter.halve->half_row(&filter.row[0], &filter.row2[0], lum, OUTPUT_WIDTH);
+		}
+		return;
+	}
+
+	// Weights are out of 256 each way, so the sums are out of 65536.
+	const filter_taps& taps = filter.down;
+	filter.shrunk_row = -1;
+	for (int y = 0; y < OUTPUT_HEIGHT; y++, lum += OUTPUT_WIDTH) {
+		unsigned int* sum = &filter.sum[0];
+		memset(sum, 0, OUTPUT_WIDTH * sizeof(*sum));
+		for (int k = 0; k < taps.count[y]; k++) {
+			unsigned int w = taps.weight[taps.start[y] + k];
+			shrink_row(origin, xwd, convert_row, tables, filter, taps.first[y] + k);
+			for (int x = 0; x < OUTPUT_WIDTH; x++)
+				sum[x] += filter.shrunk[x] * w;
+		}
+		for (int x = 0; x < OUTPUT_WIDTH; x++)
+			lum[x] = (sum[x] + 32768) >> 16;
+	}
+}
+
+// Dithering.
+
+const char* const dither_names[NUM_DITHER_MODES] = { "threshold", "bayer4", "bayer8", "floyd-steinberg", "atkinson" };
+
+int find_dither( const char* name ) {
+	for (int ii = 0; ii < NUM_DITHER_MODES; ii++)
+		if (!strcmp(name, dither_names[ii]))
+			return ii;
+	return -1;
+}
+
+// Ordered dither is thresholding against a tiled Bayer matrix.  The matrix is pinned to the screen,
+// so a pixel that doesn't change never changes its output either.
+// bayer_rows[n][y] is line y of the n x n matrix tiled across the screen, scaled so that a
+// luminance of v lights close to v/256 of the pixels.
+static unsigned char bayer_rows[2][8][OUTPUT_WIDTH];
+
+static int bayer( int n, int x, int y ) {
+	// The recursive construction: the lowest bits of x and y pick the most significant part.
+	int m = 0;
+	for (int bit = 1; bit < n; bit <<= 1) {
+		int xb = (x & bit) != 0, yb = (y & bit) != 0;
+		m = (m << 2) | ((xb ^ yb) << 1) | yb;
+	}
+	return m;
+}
+
+static struct build_bayer {
+	build_bayer() {
+		for (int size = 0; size < 2; size++) {
+			int n = size ? 8 : 4;
+			for (int y = 0; y < 8; y++)
+				for (int x = 0; x < OUTPUT_WIDTH; x++)
+					bayer_rows[size][y][x] = (2 * bayer(n, x % n, y % n) + 1) * 128 / (n * n);
+		}
+	}
+} build_bayer_tables;
+
+static void ordered_frame( const pack_kernel* kernel, int size, const unsigned char* lum, unsigned char* out ) {
+	for (int y = 0; y < OUTPUT_HEIGHT; y++, lum += OUTPUT_WIDTH, out += OUTPUT_WIDTH/8)
+		kernel->pack_row(lum, bayer_rows[size][y & 7], out, OUTPUT_WIDTH);
+}
+
+// Error diffusion: each pixel's error (what we showed minus what it should have been) is handed on
+// to its neighbours to the right and below.  Looks better than ordered dither on photos, but a
+// change anywhere ripples through everything after it, so it's no friend of anything that only sends changes.
+// The error rows have two pixels of slack either side so the edges don't need special cases.
+#define ERR_PAD 2
+
+static void diffuse_frame( bool atkinson, const unsigned char* lum, unsigned char* out ) {
+	int err_rows[3][OUTPUT_WIDTH + 2*ERR_PAD];
+	int* err[3] = { err_rows[0] + ERR_PAD, err_rows[1] + ERR_PAD, err_rows[2] + ERR_PAD };
+
+	memset(err_rows, 0, sizeof(err_rows));
+	for (int y = 0; y < OUTPUT_HEIGHT; y++, lum += OUTPUT_WIDTH, out += OUTPUT_WIDTH/8) {
+		for (int ii = 0; ii < OUTPUT_WIDTH / 8; ii++) {
+			unsigned char build = 0;
+
+			for (int jj = 0; jj < 8; jj++) {
+				int x = ii*8 + jj;
+				int v = lum[x] + err[0][x];
+				bool on = v >= 128;
+				int e = v - (on ? 255 : 0);
+
+				build = (build << 1) | on;
+				if (atkinson) {
+					// 6/8 of the error, 1/8 each to two pixels right, three below and one two below.
+					e /= 8;
+					err[0][x+1] += e;
+					err[0][x+2] += e;
+					err[1][x-1] += e;
+					err[1][x]   += e;
+					err[1][x+1] += e;
+					err[2][x]   += e;
+				} else {
+					// 7/16 right, 3/16 below left, 5/16 below, 1/16 below right
+					err[0][x+1] += e * 7 / 16;
+					err[1][x-1] += e * 3 / 16;
+					err[1][x]   += e * 5 / 16;
+					err[1][x+1] += e / 16;
+				}
+			}
+			out[ii] = build;
+		}
+
+		// Roll the rows round; the new bottom one starts empty.
+		int* done = err[0];
+		err[0] = err[1];
+		err[1] = err[2];
+		err[2] = done;
+		memset(done - ERR_PAD, 0, sizeof(err_rows[0]));
+	}
+}
+
+void dither_frame( int mode, const pack_kernel* kernel, const unsigned char* lum, unsigned char* out ) {
+	switch (mode) {
+		case DITHER_BAYER4:          ordered_frame(kernel, 0, lum, out); break;
+		case DITHER_BAYER8:          ordered_frame(kernel, 1, lum, out); break;
+		case DITHER_FLOYD_STEINBERG: diffuse_frame(false, lum, out); break;
+		case DITHER_ATKINSON:        diffuse_frame(true, lum, out); break;
+		default:                     pack_frame(kernel, lum, out, 128); return;
+	}
+
+	// For safety, the last pixel of every line must be blanked.
+	for (int y = 0; y < OUTPUT_HEIGHT; y++)
+		out[y * (OUTPUT_WIDTH/8) + OUTPUT_WIDTH/8 - 1] &= 0xfe;
+}
@@ -0,0 +1,162 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+// Turning what Xvfb draws into what the thinner client shows: reading the XWD header, per-depth
+// kernels that work out each pixel's luminance, and kernels that pack luminance into bits.
+
+#ifndef _XVSMFBG_CONVERT_
+#define _XVSMFBG_CONVERT_
+
+#include <stddef.h>
+#include <vector>
+
+// Xvfb -shmem keeps its screen as an XWD file: a header, the window name, a colormap, then the pixels.
+// This format is unfortunately hard to Google for documentation about.
+// For epsilon more documentation of the format, see: http://www.martinreddy.net/gfx/2d/XWD.txt
+// Also, apt-get source x11-apps will get xwud, a program which uses this format.
+#define XWD_FILE_VERSION  7
+#define XWD_HEADER_FIELDS 25
+#define XWD_COLOR_SIZE    12  // pixel (32 bits), red, green, blue (16 bits each), flags, pad
+#define XWD_ZPIXMAP       2
+#define XWD_MSB_FIRST     1
+#define XWD_TRUE_COLOR    4   // visual classes below this one go through the colormap
+
+// The thinner client always gets 480x240.  Bigger screens are cropped or shrunk (see screen_area),
+// smaller ones padded with black.
+#define OUTPUT_WIDTH  480
+#define OUTPUT_HEIGHT 240
+
+// What the XWD header says, in host byte order.
+struct xwd_info {
+	bool swap;               // header and colormap are the other way round from us
+	int header_size;         // including the window name; the colormap follows
+	int width, height;
+	int bytes_per_line;
+	int bits_per_pixel;
+	int byte_order;          // of the pixels
+	int visual_class;
+	unsigned long red_mask, green_mask, blue_mask;
+	int ncolors;
+	size_t pixel_offset;
+};
+
+bool parse_xwd( const unsigned char* buffer, size_t size, xwd_info& xwd );
+
+// The tone curve the conversion kernels apply: contrast about mid grey, then gamma.  It starts out
+// as the identity; set it before building the other tables.
+void build_tone_table( double gamma, double contrast );
+
+// Lookup tables for the kernels, one set per screen.
+// lum8 is for 8 bit pixels.  lum_part[n] holds what byte n of a wider pixel adds to its luminance, times 256.
+struct lum_tables {
+	unsigned char lum8[256];
+	unsigned int lum_part[4][256];
+};
+
+// The colormap one needs redoing whenever the colormap changes.
+void build_truecolor_tables( const xwd_info& xwd, lum_tables& tables );
+void build_colormap_table( const unsigned char* buffer, const xwd_info& xwd, lum_tables& tables );
+
+// One row of pixels to one byte of luminance (0-255) each.
+typedef void (*convert_row_fn)( const unsigned char* src, unsigned char* dst, int width, const lum_tables& tables );
+convert_row_fn pick_kernel( const xwd_info& xwd );
+
+// The part of the screen that's sent.  It's cropped to OUTPUT_WIDTH x OUTPUT_HEIGHT from its top
+// left, or with scale shrunk to fit, every pixel sent the average of the area of screen it covers.
+struct screen_area {
+	int x, y, width, height;   // a width or height of 0 goes to the edge of the screen
+	bool scale;
+};
+
+// Parses "WxH+X+Y" (or just "WxH") into the area.
+bool parse_area( const char* text, screen_area& area );
+
+// Fills in the edges and checks it's on the screen.  Returns false, having said why, if it isn't.
+bool fit_area( screen_area& area, const xwd_info& xwd );
+
+// How many rows of the area a frame reads, starting at area.y.
+int area_rows( const screen_area& area );
+
+// Two rows of luminance, twice OUTPUT_WIDTH wide, to one of the average of each 2x2 block.
+typedef void (*half_row_fn)( const unsigned char* top, const unsigned char* bottom, unsigned char* out, int width );
+
+struct half_kernel {
+	const char* name;
+	half_row_fn half_row;
+	bool (*supported)( void );
+};
+
+// Fastest first, like the packing kernels.
+extern const half_kernel half_kernels[];
+extern const int num_half_kernels;
+
+// For each pixel sent along one direction: the first pixel of the area it covers, how many, and
+// where their weights start.  Weights are out of 256 and add up to 256 for each.
+struct filter_taps {
+	std::vector<int> first, count, start;
+	std::vector<unsigned short> weight;
+};
+
+// What convert_frame needs to get from the screen to what's sent, worked out once, and somewhere
+// for it to work.  Shrinking by exactly 2:1 both ways has a kernel to itself.
+struct area_filter {
+	screen_area area;
+	bool half;
+	const half_kernel* halve;
+	filter_taps across, down;
+	std::vector<unsigned char> row, row2;       // luminance at the area's width
+	std::vector<unsigned short> shrunk;         // one row shrunk across, times 256
+	int shrunk_row;                             // which row of the area that is, or -1
+	std::vector<unsigned int> sum;              // a row sent, being added up, times 65536
+};
+
+// The area has to have been fitted to the screen first.
+void build_filter( area_filter& filter, const screen_area& area );
+
+// The area of the screen to OUTPUT_WIDTH x OUTPUT_HEIGHT bytes of luminance.
+void convert_frame( const unsigned char* buffer, const xwd_info& xwd, convert_row_fn convert_row, lum_tables& tables, area_filter& filter, unsigned char* lum );
+
+// One row of luminance to bits, most significant bit leftmost, set where the luminance is at least
+// the threshold for that pixel.  width is a multiple of 8.
+typedef void (*pack_row_fn)( const unsigned char* lum, const unsigned char* threshold, unsigned char* out, int width );
+
+struct pack_kernel {
+	const char* name;
+	pack_row_fn pack_row;
+	bool (*supported)( void );
+};
+
+// Every kernel built in, fastest first.  Only use the ones this CPU supports.
+extern const pack_kernel pack_kernels[];
+extern const int num_pack_kernels;
+
+// The fastest one this CPU can run, or the one named in $XVSMFBG_PACK if that's set.
+const pack_kernel* pick_pack_kernel( void );
+
+// A whole OUTPUT_WIDTH x OUTPUT_HEIGHT frame, with the last pixel of every line blanked.
+void pack_frame( const pack_kernel* kernel, const unsigned char* lum, unsigned char* out, unsigned char threshold );
+
+// Ways of getting from luminance to bits.  The ordered ones are stable from frame to frame;
+// the error diffusing ones look better but a small change can flip pixels all the way down the screen.
+enum {
+	DITHER_THRESHOLD,         // at half way
+	DITHER_BAYER4,            // ordered, 4x4 Bayer matrix
+	DITHER_BAYER8,            // ordered, 8x8 Bayer matrix
+	DITHER_FLOYD_STEINBERG,
+	DITHER_ATKINSON,
+	NUM_DITHER_MODES
+};
+
+extern const char* const dither_names[NUM_DITHER_MODES];
+
+// The mode with the given name, or -1.
+int find_dither( const char* name );
+
+// A whole OUTPUT_WIDTH x OUTPUT_HEIGHT frame, with the last pixel of every line blanked.
+// The threshold and ordered modes use the packing kernel; error diffusion is plain C.
+void dither_frame( int mode, const pack_kernel* kernel, const unsigned char* lum, unsigned char* out );
+
+#endif
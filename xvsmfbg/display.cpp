@@ -0,0 +1,426 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+#include "xvsmfbg.h"
+#include "display.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+// How long replay waits for a free slot before looking again.
+#define REPLAY_WAIT 0.0005
+
+bool parse_display( const char* arg, display_spec& spec ) {
+	string text = arg;
+	size_t comma = text.find(',');
+
+	spec.source = text.substr(0, comma);
+	spec.screen = "480x240x8";
+	spec.fps = 0;
+	spec.area.x = spec.area.y = spec.area.width = spec.area.height = 0;
+	spec.area.scale = false;
+	spec.record.clear();
+	spec.fast = false;
+	spec.outputs.clear();
+	while (comma != string::npos) {
+		size_t next = text.find(',', comma + 1);
+		string option = text.substr(comma + 1, next == string::npos ? string::npos : next - comma - 1);
+		size_t equals = option.find('=');
+		string key = option.substr(0, equals), value = equals == string::npos ? "" : option.substr(equals + 1);
+
+		if (key == "fps" && atof(value.c_str()) >= 0)
+			spec.fps = atof(value.c_str());
+		else if (key == "screen" && !value.empty())
+			spec.screen = value;
+		else if (key == "crop" && parse_area(value.c_str(), spec.area))
+			;
+		else if (key == "scale" && value.empty())
+			spec.area.scale = true;
+		else if (key == "record" && !value.empty())
+			spec.record = value;
+		else if (key == "fast" && value.empty())
+			spec.fast = true;
+		else {
+			cerr << "Don't understand \"" << option << "\" in " << arg << endl;
+			return false;
+		}
+		comma = next;
+	}
+	if (spec.source != "-" && spec.source.compare(0, 6, "shmid=") && spec.source.compare(0, 1, ":") && spec.source.compare(0, 7, "replay=")) {
+		cerr << "A display is -, shmid=N, :N or replay=file, not " << spec.source << endl;
+		return false;
+	}
+	if (spec.fast && spec.source.compare(0, 7, "replay=")) {
+		cerr << "Only a replay can go fast: " << arg << endl;
+		return false;
+	}
+	return true;
+}
+
+// Start by parsing the string printed out by: Xvfb -shmem
+// An example such string would be: "screen 0 shmid 2949151"
+static int read_shmid( istream& in ) {
+	string shmem_str;
+
+	string null;
+	in >> null;      // Ignore "screen"
+	in.ignore(1);    // Ignore " "
+	in >> null;      // Ignore screen number
+	in.ignore(1);    // Ignore " "
+	in >> null;      // Ignore "shmid"
+	in.ignore(1);    // Ignore " "
+	in >> shmem_str; // Read in the crucial shared memory ID number.
+
+	cerr << "Connecting to shared memory ID: " << shmem_str << endl;
+
+	int shmid = -1;
+
+	// Convert shmem_str to an integer, and store it in shmid.
+	stringstream ss;
+	ss << shmem_str;
+	ss >> shmid;
+	return shmid;
+}
+
+// Starts Xvfb with its output coming to us, and reads it until it says where its screen is.
+static int start_xvfb( display& disp, const display_spec& spec ) {
+	int fds[2];
+
+	// Like everything else we open, close-on-exec, so the Xvfbs for later screens don't keep
+	// earlier ones' outputs open.  dup2 clears it on Xvfb's copies.
+	if (pipe2(fds, O_CLOEXEC) == -1) {
+		perror("pipe");
+		return -1;
+	}
+	disp.xvfb = fork();
+	if (disp.xvfb == -1) {
+		perror("fork");
+		return -1;
+	}
+	if (disp.xvfb == 0) {
+		dup2(fds[1], 1);
+		dup2(fds[1], 2);
+		close(fds[0]);
+		close(fds[1]);
+		execlp("Xvfb", "Xvfb", spec.source.c_str(), "-screen", "0", spec.screen.c_str(), "-shmem", (char*) NULL);
+		perror("Xvfb");
+		_exit(127);
+	}
+	close(fds[1]);
+
+	// Xvfb says other things too, so look for the line with shmid in it.
+	string line, said;
+	char c;
+	while (read(fds[0], &c, 1) == 1) {
+		if (c != '\n') {
+			line += c;
+			continue;
+		}
+		if (line.find("shmid") != string::npos) {
+			// What it says from now on only needs reading so it never blocks writing it.
+			fcntl(fds[0], F_SETFL, O_NONBLOCK);
+			disp.xvfb_output = fds[0];
+			stringstream ss(line);
+			return read_shmid(ss);
+		}
+		said += line + "\n";
+		line.clear();
+	}
+	cerr << "Xvfb " << spec.source << " didn't say where its screen is:" << endl << said << line;
+	close(fds[0]);
+	return -1;
+}
+
+// Gets hold of Xvfb's shared memory, one way or another.
+static bool attach_screen( display& disp, const display_spec& spec, size_t& size ) {
+	int shmid;
+
+	if (spec.source == "-") {
+		cerr << "Parsing Xvfb's output..." << endl;
+		shmid = read_shmid(cin);
+	} else if (spec.source[0] == ':') {
+		cerr << "Starting Xvfb " << spec.source << " -screen 0 " << spec.screen << " -shmem" << endl;
+		shmid = start_xvfb(disp, spec);
+	} else {
+		shmid = atoi(spec.source.c_str() + 6);
+	}
+	if (shmid == -1)
+		return false;
+
+	// Connect to the shared memory object for reading, attaching anywhere.
+	char* buffer = (char*) shmat(shmid, NULL, SHM_RDONLY);
+
+	if (buffer == (void*) -1) {
+		cerr << "Error attaching to shared memory object: ";
+		perror(NULL);
+		return false;
+	}
+	disp.buffer = (unsigned char*) buffer;
+
+	// Retrieve some info about a given shared memory buffer, then spit it out.
+	struct shmid_ds shmbuffer;
+	int ctlrv = shmctl(shmid, IPC_STAT, &shmbuffer);
+
+	if (ctlrv == -1) {
+		cerr << "Error retrieving information about the shared memory segment: ";
+		perror(NULL);
+		return false;
+	}
+
+	cerr << "Attached at:        " << (void*) buffer << endl;
+	cerr << "Buffer Size:        " << shmbuffer.shm_segsz << endl;
+	cerr << "Buffer Attach Time: " << ctime(&shmbuffer.shm_atime);
+	cerr << "Buffer Change Time: " << ctime(&shmbuffer.shm_ctime);
+	size = shmbuffer.shm_segsz;
+	return true;
+}
+
+bool display_open( display& disp, const display_spec& spec ) {
+	size_t size;
+
+	disp.name = spec.source == "-" ? "stdin" : spec.source;
+	disp.xvfb = 0;
+	disp.xvfb_output = -1;
+	disp.buffer = NULL;
+	disp.record.file = disp.replay.file = NULL;
+	for (int ii = 0; ii < PIPELINE_SLOTS; ii++)
+		disp.slots[ii].screen = NULL;
+
+	cerr << "===== " << disp.name << endl;
+	if (!spec.source.compare(0, 7, "replay=")) {
+		cerr << "Replaying " << spec.source.substr(7) << (spec.fast ? " as fast as it'll go" : " as it was recorded") << endl;
+		if (!replay_open(disp.replay, spec.source.c_str() + 7, spec.fast, disp.buffer, size))
+			return false;
+	} else if (!attach_screen(disp, spec, size)) {
+		return false;
+	}
+
+	// Find out what Xvfb is giving us.
+	if (!parse_xwd(disp.buffer, size, disp.xwd))
+		return false;
+
+	screen_area area = spec.area;
+	if (!fit_area(area, disp.xwd))
+		return false;
+
+	cerr << "Screen:             " << disp.xwd.width << "x" << disp.xwd.height << ", " << disp.xwd.bits_per_pixel << " bits per pixel" << endl;
+	cerr << "Sending:            " << area.width << "x" << area.height << "+" << area.x << "+" << area.y;
+	if (area.scale)
+		cerr << " shrunk to " << OUTPUT_WIDTH << "x" << OUTPUT_HEIGHT << (area.width == 2 * OUTPUT_WIDTH && area.height == 2 * OUTPUT_HEIGHT ? " (2:1)" : "");
+	else if (area.width > OUTPUT_WIDTH || area.height > OUTPUT_HEIGHT)
+		cerr << " cropped to " << OUTPUT_WIDTH << "x" << OUTPUT_HEIGHT;
+	cerr << endl;
+
+	if (disp.xwd.visual_class >= XWD_TRUE_COLOR)
+		build_truecolor_tables(disp.xwd, disp.tables);
+	disp.convert_row = pick_kernel(disp.xwd);
+	build_filter(disp.filter, area);
+
+	watch_init(disp.watch, area);
+	disp.next_look = 0;
+	disp.min_interval = spec.fps > 0 ? 1 / spec.fps : 0;
+	disp.dirty = false;
+	disp.frame = 0;
+	disp.last_captured = -1e9;
+	disp.looks = 0;
+	disp.look_seconds = 0;
+
+	// Every buffer a frame goes through, allocated now so none are while it runs.
+	// Recordings have the whole screen, so they can be cropped differently when they're replayed.
+	if (!spec.record.empty() || disp.replay.file)
+		disp.capture_size = disp.xwd.pixel_offset + (size_t) disp.xwd.height * disp.xwd.bytes_per_line;
+	else
+		disp.capture_size = disp.xwd.pixel_offset + (size_t) (area.y + area_rows(area)) * disp.xwd.bytes_per_line;
+	queue_init(disp.free);
+	queue_init(disp.captured);
+	queue_init(disp.converted);
+	queue_init(disp.encoded);
+	for (int ii = 0; ii < PIPELINE_SLOTS; ii++) {
+		disp.slots[ii].screen = new unsigned char[disp.capture_size];
+		memset(disp.slots[ii].screen, 0, disp.capture_size);  // and fault it in
+		queue_push(disp.free, &disp.slots[ii]);
+	}
+	disp.current = NULL;
+	disp.pending = NULL;
+	disp.ended = false;
+	counter_init(disp.capture_time);
+	counter_init(disp.convert_wait);
+	counter_init(disp.convert_time);
+	counter_init(disp.encode_wait);
+	counter_init(disp.encode_time);
+	counter_init(disp.transmit_wait);
+	counter_init(disp.write_time);
+	counter_init(disp.total_time);
+	disp.dropped = 0;
+
+	if (!spec.record.empty()) {
+		if (!record_open(disp.record, spec.record.c_str()))
+			return false;
+		cerr << "Recording to:       " << spec.record << endl;
+	}
+
+	disp.outputs.resize(spec.outputs.size());
+	disp.sending.resize(spec.outputs.size());
+	for (size_t ii = 0; ii < spec.outputs.size(); ii++) {
+		if (!output_open(disp.outputs[ii], spec.outputs[ii]))
+			return false;
+		cerr << "Sending to:         " << disp.outputs[ii].name << endl;
+	}
+	return true;
+}
+
+void display_close( display& disp ) {
+	// Finally, detatch from the buffer.
+	if (disp.replay.file) {
+		delete[] disp.buffer;
+		record_close(disp.replay);
+	} else if (disp.buffer && shmdt(disp.buffer) == -1) {
+		cerr << "Error detatching from shared memory object: ";
+		perror(NULL);
+	}
+	record_close(disp.record);
+	for (size_t ii = 0; ii < disp.outputs.size(); ii++)
+		output_close(disp.outputs[ii]);
+	if (disp.xvfb > 0) {
+		kill(disp.xvfb, SIGTERM);
+		waitpid(disp.xvfb, NULL, 0);
+	}
+	if (disp.xvfb_output != -1)
+		close(disp.xvfb_output);
+	for (int ii = 0; ii < PIPELINE_SLOTS; ii++)
+		delete[] disp.slots[ii].screen;
+}
+
+// Replay instead reads each frame straight into a free slot, and sends it on when it's due.
+static double replay_capture( display& disp, double t ) {
+	if (disp.ended)
+		return t + 1;
+	if (!disp.pending) {
+		frame_slot* slot = queue_pop(disp.free);
+		if (!slot)
+			return t + REPLAY_WAIT;
+		if (!replay_frame(disp.replay, slot->screen, disp.capture_size, disp.pending_due)) {
+			// Nothing more gets captured, so the slot just stays here: only transmit hands slots back.
+			__atomic_store_n(&disp.ended, true, __ATOMIC_RELEASE);
+			return t + 1;
+		}
+		disp.pending = slot;
+	}
+	if (t < disp.pending_due)
+		return disp.pending_due;
+
+	frame_slot* slot = disp.pending;
+	disp.pending = NULL;
+	slot->looked = t;
+	slot->frame = ++disp.frame;
+	slot->captured = now();
+	slot->started = false;
+	queue_push(disp.captured, slot);
+	disp.last_captured = t;
+	if (disp.record.file)
+		record_frame(disp.record, t, slot->screen, disp.capture_size);
+	return t;
+}
+
+double display_capture( display& disp, double t, const display_settings& settings ) {
+	if (disp.replay.file)
+		return replay_capture(disp, t);
+
+	if (disp.xvfb_output != -1) {
+		char junk[256];
+		while (read(disp.xvfb_output, junk, sizeof(junk)) > 0)
+			;
+	}
+
+	// Hashing the screen is much cheaper than copying it, so do that every time round
+	// and only copy when something changed.
+	if (t >= disp.next_look) {
+		double start = now();
+		if (screen_changes(disp.buffer, disp.xwd, disp.watch))
+			disp.dirty = true;
+		if (settings.refresh > 0 && t - disp.last_captured >= settings.refresh)
+			disp.dirty = true;
+		disp.looks++;
+		disp.next_look = t + settings.poll_interval;
+		disp.look_seconds += now() - start;
+	}
+
+	if (!disp.dirty)
+		return disp.next_look;
+	if (t - disp.last_captured < disp.min_interval)
+		return min(disp.next_look, disp.last_captured + disp.min_interval);
+
+	// Take a copy, so the later stages see one screenful however Xvfb carries on drawing.
+	frame_slot* slot = queue_pop(disp.free);
+	if (!slot)
+		return disp.next_look;
+	slot->looked = t;
+	memcpy(slot->screen, disp.buffer, disp.capture_size);
+	slot->frame = ++disp.frame;
+	slot->captured = now();
+	slot->started = false;
+	queue_push(disp.captured, slot);
+	disp.dirty = false;
+	disp.last_captured = t;
+
+	// Nothing else writes to the slot's screen before it comes back round to us.
+	if (disp.record.file)
+		record_frame(disp.record, t, slot->screen, disp.capture_size);
+	return disp.next_look;
+}
+
+void display_convert( display& disp, frame_slot& slot ) {
+	// Work out the luminance of each pixel.
+	slot.convert_start = now();
+	convert_frame(slot.screen, disp.xwd, disp.convert_row, disp.tables, disp.filter, slot.lum);
+	slot.converted = now();
+}
+
+void display_encode( display& disp, frame_slot& slot, const display_settings& settings ) {
+	// Dither the frame to bitpacked monochrome. (most significant bit = leftmost pixel in byte)
+	slot.encode_start = now();
+	dither_frame(settings.dither, settings.pack, slot.lum, slot.bits);
+	slot.encoded = now();
+}
+
+bool display_receive( display& disp ) {
+	frame_slot* slot;
+	bool got = false;
+
+	// Latest frame wins: anything older goes back to be captured into again.
+	while ((slot = queue_pop(disp.encoded))) {
+		counter_add(disp.capture_time, slot->captured - slot->looked);
+		counter_add(disp.convert_wait, slot->convert_start - slot->captured);
+		counter_add(disp.convert_time, slot->converted - slot->convert_start);
+		counter_add(disp.encode_wait, slot->encode_start - slot->converted);
+		counter_add(disp.encode_time, slot->encoded - slot->encode_start);
+		if (disp.current) {
+			if (!disp.current->started)
+				disp.dropped++;
+			queue_push(disp.free, disp.current);
+		}
+		disp.current = slot;
+		got = true;
+	}
+	return got;
+}
+
+bool display_finished( const display& disp ) {
+	if (!__atomic_load_n(&disp.ended, __ATOMIC_ACQUIRE))
+		return false;
+	if (!disp.frame)
+		return true;
+	if (!disp.current || disp.current->frame != disp.frame)
+		return false;
+	for (size_t ii = 0; ii < disp.outputs.size(); ii++) {
+		const output& out = disp.outputs[ii];
+		// Not output_busy(), which is false while waiting for credit or to be able to write.
+		if (!out.dead && !out.waiting && (out.frame != disp.frame || out.sent < FRAME_BYTES))
+			return false;
+	}
+	return true;
+}
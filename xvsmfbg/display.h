@@ -0,0 +1,108 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+// One Xvfb screen and everything it's sent to.  xvsmfbg can look after any number of them.
+
+#ifndef _XVSMFBG_DISPLAY_
+#define _XVSMFBG_DISPLAY_
+
+#include "output.h"
+#include "pipeline.h"
+#include "record.h"
+
+#include <string>
+#include <vector>
+
+// Where the screen comes from:
+//   "-"          read Xvfb -shmem's "screen 0 shmid N" from stdin, as always
+//   "shmid=N"    a shared memory segment that's already there
+//   ":N"         start "Xvfb :N -screen 0 <screen> -shmem" ourselves
+//   "replay=F"   the frames in a recording (see record.h), as they were recorded or, with fast,
+//                each as soon as there's room for it
+struct display_spec {
+	std::string source;
+	std::string screen;      // for Xvfb, WxHxD
+	double fps;              // at most this many frames a second captured, or 0 for no limit
+	screen_area area;        // what part of it is sent
+	std::string record;      // where to record what's captured, or ""
+	bool fast;
+	std::vector<output_spec> outputs;
+};
+
+struct display {
+	std::string name;
+	pid_t xvfb;              // the Xvfb we started, or 0
+	int xvfb_output;         // ...and what it says, which we throw away, or -1
+
+	unsigned char* buffer;
+	xwd_info xwd;
+	size_t capture_size;     // how much of buffer a frame needs: up to the end of the last row of the area
+
+	// Capture's
+	screen_watch watch;
+	double next_look;
+	double min_interval;     // between captures, from fps
+	bool dirty;              // changed since it was last captured
+	long frame;              // how many we've captured
+	double last_captured;
+	long looks;
+	double look_seconds;
+	recording record;        // file is NULL unless recording
+	recording replay;        // file is NULL unless replaying
+	frame_slot* pending;     // replay: read, and waiting until pending_due
+	double pending_due;
+	bool ended;              // replay: it's all been captured, and frame won't change again
+
+	// Convert's
+	lum_tables tables;
+	convert_row_fn convert_row;
+	area_filter filter;
+
+	// Between the stages; see pipeline.h
+	frame_slot slots[PIPELINE_SLOTS];
+	frame_queue free, captured, converted, encoded;
+
+	// Transmit's
+	frame_slot* current;     // the newest frame, or NULL
+	std::vector<output> outputs;
+	stage_counter capture_time, convert_wait, convert_time, encode_wait, encode_time, transmit_wait;
+	stage_counter write_time, total_time;   // from starting on a frame, and from seeing it change, to having written it
+	std::vector<frame_times> sending;        // the frame each output is on
+	long dropped;            // frames no output was started on before a newer one came
+};
+
+// Parses "source[,fps=N][,screen=WxHxD][,crop=WxH+X+Y][,scale][,record=file][,fast]".  Returns false, having said why, if it can't.
+bool parse_display( const char* arg, display_spec& spec );
+
+// Gets hold of the screen, starting Xvfb if it has to, and opens the outputs.  Returns false, having said why, if it can't.
+bool display_open( display& disp, const display_spec& spec );
+
+void display_close( display& disp );
+
+// What the stages need to know besides the screen.
+struct display_settings {
+	int dither;
+	const pack_kernel* pack;
+	double poll_interval;
+	double refresh;
+};
+
+// Capture: look at the screen, and if it's changed (or is due a refresh) copy it into a free slot
+// and send it on to convert.  Returns when it next wants to be called.
+double display_capture( display& disp, double t, const display_settings& settings );
+
+// Convert and encode: do their stage to the slot.
+void display_convert( display& disp, frame_slot& slot );
+void display_encode( display& disp, frame_slot& slot, const display_settings& settings );
+
+// Transmit: take the newest frame encode has finished, returning any older ones.  Returns true if there was one.
+bool display_receive( display& disp );
+
+// Whether a replay has finished: every frame captured, the last one received, and every output
+// done with it.  Anything else is never finished.
+bool display_finished( const display& disp );
+
+#endif
@@ -4,11 +4,21 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <signal.h>
+#ifndef NO_SDL
 #include <SDL.h>
+#endif
 
 // Read at most one frame in one sitting.
 #define MAX_READ_IN_ONE_SITTING (14400)
 
+// One 480x240 frame, packed 8 pixels to the byte
+#define FRAME_BYTES (480*240/8)
+
 int WIDTH, HEIGHT;
 
 #define BPP 4
@@ -16,6 +26,41 @@ int WIDTH, HEIGHT;
 
 char keys_held[1024] = {0};
 
+// Headless mode: no window.  Frames are read as fast as they come and written out, hashed and timed instead.
+int headless = 0;
+char *pbm_pattern = NULL;  // write frames as PBM images, e.g. frame%05d.pbm
+int every = 1;             // ...but only every Nth one
+int print_hash = 0;        // print a hash of each frame, for comparing against a known good run
+
+// Credit: with -credit, one CREDIT_BYTE goes back for every row taken off the stream, so
+// xvsmfbg -credit never has more in flight than we've said we can take.
+#define CREDIT_BYTE 0x06
+#define ROW_BYTES (480/8)
+int credit_fd = -1;
+long credit_bytes = 0;     // stream bytes taken so far...
+long credit_rows = 0;      // ...and rows credited for
+
+void give_credit(ssize_t got) {
+	static unsigned char credits[240];
+	long due;
+
+	if (credit_fd < 0) return;
+	credit_bytes += got;
+	due = credit_bytes / ROW_BYTES - credit_rows;
+	while (due > 0) {
+		long n = due < (long)sizeof(credits) ? due : (long)sizeof(credits);
+		memset(credits, CREDIT_BYTE, n);
+		if (write(credit_fd, credits, n) != n) {
+			// nobody listening any more; carry on without
+			close(credit_fd);
+			credit_fd = -1;
+			return;
+		}
+		credit_rows += n;
+		due -= n;
+	}
+}
+
 int can_read( int fd ) {
 	fd_set sready;
 	struct timeval nowait;
@@ -34,59 +79,69 @@ int can_read( int fd ) {
 	}
 }
 
-inline void setpixel(SDL_Surface *screen, int x, int y, Uint32 colour) {
-	Uint32 *pixmem32;
-
-	if (x < 0 || x >= WIDTH || y < 0 || y >= HEIGHT) return;
+// Every byte of the stream expanded to its eight pixels, so unpacking is a table lookup and a copy.
+uint32_t pixel_lut[256][8];
 
-	y = y*screen->pitch/BPP;
-
-	pixmem32 = (Uint32*) screen->pixels + y + x;
-	*pixmem32 = colour;
+void build_lut(uint32_t white, uint32_t black) {
+	int ii, jj;
+	for (ii = 0; ii < 256; ii++)
+		for (jj = 0; jj < 8; jj++)
+			pixel_lut[ii][jj] = (ii & (0x80 >> jj)) ? white : black;
 }
 
+#ifndef NO_SDL
 void DrawScreen(SDL_Surface* screen) {
+	static unsigned char chunk[MAX_READ_IN_ONE_SITTING];
+	static int lut_ready = 0;
+	static int xx = 0;  // in bytes
+	static int yy = 0;
+
+	const int row_bytes = WIDTH/8;
+	int first_row = yy;
+	int rows;
+	ssize_t got, ii;
+	Uint32 *row;
+
+	if (!lut_ready) {
+		build_lut(SDL_MapRGB( screen->format, 255, 255, 255 ), SDL_MapRGB( screen->format, 0, 0, 0 ));
+		lut_ready = 1;
+	}
 
-	const Uint32 white = SDL_MapRGB( screen->format, 255, 255, 255 );
-	const Uint32 black = SDL_MapRGB( screen->format, 0, 0, 0 );
+	// one read for as much as has arrived, instead of a select and a read per byte
+	if (!can_read(0)) return;
+	got = read(0, chunk, sizeof(chunk));
+	if (got <= 0) return;
+	give_credit(got);
 
 	if(SDL_MUSTLOCK(screen)) 
 	{
 		if(SDL_LockSurface(screen) < 0) return;
 	}
 
-	//SDL_FillRect(screen, NULL, black);
-
-	static int xx = 0;
-	static int yy = 0;
-
-	unsigned char monochrome_packed_byte;
-	int read_more = MAX_READ_IN_ONE_SITTING;
-	while (can_read(0) && (read_more--)) {
-		read(0, &monochrome_packed_byte, 1);
-
-		int ii;
-		for (ii=0; ii<8; ii++) {
-			if (monochrome_packed_byte & 0x80) {
-				setpixel(screen, xx, yy, white);
-			} else {
-				setpixel(screen, xx, yy, black);
-			}
-			monochrome_packed_byte <<= 1;
-			xx++;
-		}
-		if (xx >= WIDTH) {
+	rows = (xx + got + row_bytes - 1) / row_bytes;
+	row = (Uint32 *)((Uint8 *)screen->pixels + yy*screen->pitch);
+	for (ii = 0; ii < got; ii++) {
+		memcpy(row + xx*8, pixel_lut[chunk[ii]], sizeof(pixel_lut[0]));
+		if (++xx >= row_bytes) {
 			xx = 0;
-			yy++;
-		}
-		if (yy >= HEIGHT) {
-			yy = 0;
+			if (++yy >= HEIGHT) {
+				yy = 0;
+			}
+			row = (Uint32 *)((Uint8 *)screen->pixels + yy*screen->pitch);
 		}
 	}
 
 	if(SDL_MUSTLOCK(screen)) SDL_UnlockSurface(screen);
 
-	SDL_Flip(screen); 
+	// only push the rows we drew to the screen; if we went off the bottom, that's two pieces
+	if (rows >= HEIGHT) {
+		SDL_UpdateRect(screen, 0, 0, WIDTH, HEIGHT);
+	} else if (first_row + rows <= HEIGHT) {
+		SDL_UpdateRect(screen, 0, first_row, WIDTH, rows);
+	} else {
+		SDL_UpdateRect(screen, 0, first_row, WIDTH, HEIGHT - first_row);
+		SDL_UpdateRect(screen, 0, 0, WIDTH, first_row + rows - HEIGHT);
+	}
 }
 
 SDL_Surface *load_image( const char *path ) {
@@ -109,11 +164,127 @@ SDL_Surface *load_image( const char *path ) {
 	return image;
 }
 
+#endif
+
+double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Unpack a frame to 32 bit pixels, the same work DrawScreen does, so headless runs time it too.
+void unpack_frame(const unsigned char *frame, uint32_t *pixels) {
+	int ii;
+	for (ii = 0; ii < FRAME_BYTES; ii++) {
+		memcpy(pixels, pixel_lut[frame[ii]], sizeof(pixel_lut[0]));
+		pixels += 8;
+	}
+}
+
+void write_pbm(const unsigned char *frame, long number) {
+	char name[256];
+	FILE *f;
+
+	snprintf(name, sizeof(name), pbm_pattern, number);
+	f = fopen(name, "wb");
+	if (f == NULL) {
+		perror(name);
+		exit(1);
+	}
+	// the stream is already in PBM's raw layout
+	fprintf(f, "P4\n480 240\n");
+	fwrite(frame, 1, FRAME_BYTES, f);
+	fclose(f);
+}
+
+int run_headless(void) {
+	static unsigned char frame[FRAME_BYTES];
+	static uint32_t pixels[FRAME_BYTES*8];
+	long frames = 0;
+	double bytes = 0, decode = 0;
+	double start = now();
+	double elapsed, t;
+	size_t have = 0;
+	ssize_t got;
+
+	build_lut(0xFFFFFF, 0);
+	while ((got = read(0, frame + have, FRAME_BYTES - have)) != 0) {
+		if (got < 0) {
+			if (errno == EINTR) continue;
+			perror("read");
+			return 1;
+		}
+		bytes += got;
+		have += got;
+		give_credit(got);
+		if (have < FRAME_BYTES) continue;
+		have = 0;
+
+		t = now();
+		unpack_frame(frame, pixels);
+		decode += now() - t;
+
+		if (print_hash) {
+			// FNV-1a
+			uint32_t hash = 2166136261u;
+			int ii;
+			for (ii = 0; ii < FRAME_BYTES; ii++)
+				hash = (hash ^ frame[ii]) * 16777619u;
+			printf("%ld %08x\n", frames, hash);
+		}
+		if (pbm_pattern && frames % every == 0)
+			write_pbm(frame, frames);
+		frames++;
+	}
+
+	elapsed = now() - start;
+	if (frames && elapsed > 0)
+		fprintf(stderr, "%ld frames in %.3f s: %.1f frames/s, %.0f bytes/s, decode %.2f us/frame\n",
+			frames, elapsed, frames / elapsed, bytes / elapsed, decode * 1e6 / frames);
+	return 0;
+}
+
 int main(int argc, char **argv) {
+#ifndef NO_SDL
 	SDL_Surface *screen;
 	SDL_Event event;
 	const SDL_VideoInfo *info;
 	int continue_running = 1;
+#endif
+	int arg;
+	char *credit_path = NULL;
+
+	for (arg = 1; arg < argc; arg++) {
+		if (!strcmp(argv[arg], "-headless"))
+			headless = 1;
+		else if (!strcmp(argv[arg], "-hash"))
+			print_hash = 1;
+		else if (!strcmp(argv[arg], "-pbm") && arg+1 < argc)
+			pbm_pattern = argv[++arg];
+		else if (!strcmp(argv[arg], "-every") && arg+1 < argc)
+			every = atoi(argv[++arg]);
+		else if (!strcmp(argv[arg], "-credit") && arg+1 < argc)
+			credit_path = argv[++arg];
+		else {
+			fprintf(stderr, "usage: %s [-headless [-pbm pattern] [-every N] [-hash]] [-credit fifo] < stream\n", argv[0]);
+			return 1;
+		}
+	}
+	if (every < 1) every = 1;
+	if (credit_path) {
+		signal(SIGPIPE, SIG_IGN);
+		credit_fd = open(credit_path, O_WRONLY);
+		if (credit_fd < 0) {
+			perror(credit_path);
+			return 1;
+		}
+	}
+
+#ifdef NO_SDL
+	return run_headless();
+#else
+	if (headless)
+		return run_headless();
 
 	if (SDL_Init(SDL_INIT_VIDEO) < 0 ) return 1;
 
@@ -166,5 +337,6 @@ int main(int argc, char **argv) {
 	SDL_Quit();
 
 	return 0;
+#endif
 }
 
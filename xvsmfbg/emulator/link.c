@@ -0,0 +1,393 @@
+// tc_link: a serial cable, for testing without one.
+//
+// Bytes are passed from stdin to stdout no faster than a real serial port would pass them, so
+// pacing and flow control can be tried out against an emulator:
+//
+//	./xvsmfbg | emulator/tc_link -baud 921600 | emulator/tc_emulator
+//	../Source\ Code/host/emulator emulator/tc_link -baud 57600 bash
+//
+// Given a command, tc_link runs it on a pty instead, and what it prints goes over the "cable"
+// to stdout while stdin goes back to it at the same rate, like a terminal on a serial line.
+//
+// The far end can have a receive buffer (-rxbuf) that it empties at a fixed rate (-drain) or as
+// fast as stdout is read, and that drops whatever arrives while it is full, like the firmware's
+// serial buffer.  -rtscts and -xonxoff stop the sender when it is three quarters full and start it
+// again at a quarter; XOFF and XON take a character time to get back and another to take effect.
+//
+// What got through, what was dropped and how busy the link was go to stderr at the end, and
+// every -report seconds.
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// The host serial driver's transmit buffer.  Writers block once it's full, like on a real port.
+#define TX_SIZE 4096
+
+// Staging for the far end when it has no receive buffer of its own; the link just waits for it.
+#define RX_STAGING 4096
+
+#define REVERSE_SIZE 256
+
+enum { FLOW_NONE, FLOW_RTSCTS, FLOW_XONXOFF };
+
+long baud = 921600;
+int char_bits = 10;     // start + 8 data + stop
+int rx_size = 0;        // the far end's receive buffer, 0 for none
+long drain_rate = 0;    // bytes per second the far end takes out of it, 0 for as fast as stdout is read
+int flow = FLOW_NONE;
+double report_every = 0;
+
+volatile int keep_running = 1;
+
+void stop_running(int sig) {
+	(void)sig;
+	keep_running = 0;
+}
+
+uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+typedef struct {
+	unsigned char *data;
+	int size, head, count;
+} ring_t;
+
+void ring_init(ring_t *r, int size) {
+	r->data = malloc(size);
+	if (r->data == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	r->size = size;
+	r->head = r->count = 0;
+}
+
+// Contiguous room to read into, and contiguous data to write out.
+unsigned char *ring_space(ring_t *r, int *len) {
+	int tail = (r->head + r->count) % r->size;
+	if (r->count == r->size)
+		*len = 0;
+	else
+		*len = (tail >= r->head) ? r->size - tail : r->head - tail;
+	return r->data + tail;
+}
+
+unsigned char *ring_data(ring_t *r, int *len) {
+	*len = r->count < r->size - r->head ? r->count : r->size - r->head;
+	return r->data + r->head;
+}
+
+void ring_put(ring_t *r, unsigned char c) {
+	r->data[(r->head + r->count) % r->size] = c;
+	r->count++;
+}
+
+unsigned char ring_get(ring_t *r) {
+	unsigned char c = r->data[r->head];
+	r->head = (r->head + 1) % r->size;
+	r->count--;
+	return c;
+}
+
+void ring_drop(ring_t *r, int n) {
+	r->head = (r->head + n) % r->size;
+	r->count -= n;
+}
+
+// e.g. 8N1, 7E1, 8N2
+int parse_framing(const char *s) {
+	if (strlen(s) != 3 || s[0] < '5' || s[0] > '8' || !strchr("NEOneo", s[1]) || (s[2] != '1' && s[2] != '2'))
+		return 0;
+	return 1 + (s[0] - '0') + (toupper(s[1]) != 'N') + (s[2] - '0');
+}
+
+// Link statistics
+uint64_t start_ns, stopped_ns;
+long long bytes_in, bytes_sent, bytes_out, bytes_dropped;
+int rx_high_water;
+
+void report(uint64_t t) {
+	double elapsed = (t - start_ns) / 1e9;
+	double rate = elapsed > 0 ? bytes_sent / elapsed : 0;
+
+	fprintf(stderr, "%.1f s: in %lld, sent %lld, out %lld, dropped %lld; %.0f bytes/s, link %.1f%% busy",
+		elapsed, bytes_in, bytes_sent, bytes_out, bytes_dropped, rate, 100.0 * rate * char_bits / baud);
+	if (flow != FLOW_NONE)
+		fprintf(stderr, ", stopped %.1f%% of the time", elapsed > 0 ? 100.0 * stopped_ns / 1e9 / elapsed : 0);
+	if (rx_size)
+		fprintf(stderr, ", receive buffer high water %d/%d", rx_high_water, rx_size);
+	fprintf(stderr, "\n");
+}
+
+void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-baud N] [-framing 8N1] [-rxbuf N [-drain N] [-rtscts | -xonxoff]] [-report S] [command args...]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	ring_t tx, rx, reverse;
+	struct termios saved_tio, raw;
+	int restore_tio = 0;
+	int up = 0;             // where the bytes for the far end come from
+	int upstream_eof = 0;
+	int stdin_eof = 0;
+	int arg;
+	pid_t child = 0;
+
+	uint64_t char_ns, t, last_report, drain_t;
+	uint64_t wire_free;     // when the character on the wire (if any) finishes
+	uint64_t reverse_free;
+	uint64_t stop_at = UINT64_MAX;  // the sender is stopped from stop_at until go_at
+	uint64_t go_at = UINT64_MAX;
+	int want_stop = 0;              // the far end is asking it to stop
+
+	for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (!strcmp(argv[arg], "-baud") && arg+1 < argc)
+			baud = atol(argv[++arg]);
+		else if (!strcmp(argv[arg], "-framing") && arg+1 < argc) {
+			if (!(char_bits = parse_framing(argv[++arg])))
+				usage(argv[0]);
+		}
+		else if (!strcmp(argv[arg], "-rxbuf") && arg+1 < argc)
+			rx_size = atoi(argv[++arg]);
+		else if (!strcmp(argv[arg], "-drain") && arg+1 < argc)
+			drain_rate = atol(argv[++arg]);
+		else if (!strcmp(argv[arg], "-rtscts"))
+			flow = FLOW_RTSCTS;
+		else if (!strcmp(argv[arg], "-xonxoff"))
+			flow = FLOW_XONXOFF;
+		else if (!strcmp(argv[arg], "-report") && arg+1 < argc)
+			report_every = atof(argv[++arg]);
+		else
+			usage(argv[0]);
+	}
+	if (baud <= 0 || rx_size < 0)
+		usage(argv[0]);
+	if (flow != FLOW_NONE && rx_size < 4) {
+		fprintf(stderr, "flow control needs a receive buffer (-rxbuf) to watch\n");
+		usage(argv[0]);
+	}
+
+	if (arg < argc) {
+		child = forkpty(&up, NULL, NULL, NULL);
+		if (child < 0) {
+			perror("forkpty");
+			return 1;
+		}
+		if (child == 0) {
+			execvp(argv[arg], argv + arg);
+			perror(argv[arg]);
+			_exit(127);
+		}
+		// keystrokes go through one at a time, as typed
+		if (isatty(0) && tcgetattr(0, &saved_tio) == 0) {
+			raw = saved_tio;
+			cfmakeraw(&raw);
+			tcsetattr(0, TCSANOW, &raw);
+			restore_tio = 1;
+		}
+	}
+
+	fcntl(up, F_SETFL, fcntl(up, F_GETFL) | O_NONBLOCK);
+	fcntl(1, F_SETFL, fcntl(1, F_GETFL) | O_NONBLOCK);
+#ifdef F_SETPIPE_SZ
+	// keep what the pipe itself holds down to a page, so the receive buffer is the one that fills
+	fcntl(1, F_SETPIPE_SZ, 4096);
+#endif
+
+	signal(SIGINT, stop_running);
+	signal(SIGTERM, stop_running);
+	signal(SIGPIPE, SIG_IGN);
+
+	ring_init(&tx, TX_SIZE);
+	ring_init(&rx, rx_size ? rx_size : RX_STAGING);
+	ring_init(&reverse, REVERSE_SIZE);
+
+	char_ns = 1000000000ull * char_bits / baud;
+	start_ns = last_report = drain_t = wire_free = reverse_free = now_ns();
+
+	while (keep_running) {
+		struct pollfd fds[4];
+		int nfds = 0, up_fd = -1, in_fd = -1;
+		uint64_t next = UINT64_MAX;
+		int len, n;
+		unsigned char *p;
+
+		t = now_ns();
+
+		// Put characters on the wire, one char time apiece, as long as the far end will have them.
+		while (tx.count && (rx_size || rx.count < rx.size)) {
+			uint64_t start = wire_free;
+			if (start >= stop_at && start < go_at) {
+				if (go_at == UINT64_MAX) break;
+				start = go_at;
+			}
+			if (start + char_ns > t) break;
+			wire_free = start + char_ns;
+
+			bytes_sent++;
+			if (rx.count < rx.size)
+				ring_put(&rx, ring_get(&tx));
+			else {
+				ring_get(&tx);
+				bytes_dropped++;
+			}
+			if (rx.count > rx_high_water)
+				rx_high_water = rx.count;
+
+			if (flow != FLOW_NONE && !want_stop && rx.count >= rx_size * 3 / 4) {
+				// RTS drops at once and the sender finishes the character it's on; XOFF has to get back first
+				want_stop = 1;
+				stop_at = wire_free + (flow == FLOW_XONXOFF ? 2 * char_ns : 0);
+				go_at = UINT64_MAX;
+			}
+		}
+		// an idle or held up line doesn't save up time to send in a burst later
+		if (wire_free < t && (!tx.count || (!rx_size && rx.count == rx.size)))
+			wire_free = t;
+
+		// The far end empties its buffer.
+		if (rx.count) {
+			len = rx.count;
+			if (drain_rate) {
+				long allowed = (long)((t - drain_t) * (double)drain_rate / 1e9);
+				if (allowed < len) len = allowed;
+			}
+			p = ring_data(&rx, &n);
+			if (len > n) len = n;
+			if (len > 0) {
+				n = write(1, p, len);
+				if (n > 0) {
+					ring_drop(&rx, n);
+					bytes_out += n;
+					if (drain_rate) drain_t += (uint64_t)(n * 1e9 / drain_rate);
+				}
+				else if (n < 0 && errno != EAGAIN && errno != EINTR)
+					break;
+			}
+		}
+		if (drain_rate && (!rx.count || t - drain_t > 1000000000ull))
+			drain_t = t;
+
+		// ...and once it has room again, lets the sender go.
+		if (want_stop && rx.count <= rx_size / 4) {
+			want_stop = 0;
+			go_at = t + (flow == FLOW_XONXOFF ? 2 * char_ns : 0);
+			if (go_at < stop_at) go_at = stop_at;
+		}
+		if (!want_stop && go_at != UINT64_MAX && t >= go_at) {
+			stopped_ns += go_at - stop_at;
+			if (wire_free < go_at) wire_free = go_at;
+			stop_at = go_at = UINT64_MAX;
+		}
+
+		// Keystrokes go back to the command at the same rate.
+		while (reverse.count && reverse_free + char_ns <= t) {
+			unsigned char c = reverse.data[reverse.head];
+			if (write(up, &c, 1) != 1)
+				break;
+			ring_get(&reverse);
+			reverse_free += char_ns;
+		}
+		if (!reverse.count && reverse_free < t)
+			reverse_free = t;
+
+		if (report_every > 0 && t - last_report >= report_every * 1e9) {
+			report(t);
+			last_report = t;
+		}
+
+		if (upstream_eof && !tx.count && !rx.count)
+			break;
+
+		// Wait for the next thing to do.
+		if (!upstream_eof && tx.count < tx.size) {
+			fds[nfds].fd = up;
+			fds[nfds].events = POLLIN;
+			up_fd = nfds++;
+		}
+		if (tx.count && (rx_size || rx.count < rx.size))
+			next = (wire_free >= stop_at && wire_free < go_at ? go_at : wire_free) + char_ns;
+		if (go_at != UINT64_MAX && go_at < next)
+			next = go_at;
+		if (rx.count) {
+			uint64_t d = drain_rate ? drain_t + 1000000000ull / drain_rate : t;
+			if (d > t) {
+				if (d < next) next = d;
+			}
+			else {
+				fds[nfds].fd = 1;
+				fds[nfds].events = POLLOUT;
+				nfds++;
+			}
+		}
+		if (child && !stdin_eof && reverse.count < reverse.size) {
+			fds[nfds].fd = 0;
+			fds[nfds].events = POLLIN;
+			in_fd = nfds++;
+		}
+		if (reverse.count) {
+			if (reverse_free + char_ns < next) next = reverse_free + char_ns;
+			fds[nfds].fd = up;
+			fds[nfds].events = POLLOUT;
+			nfds++;
+		}
+		if (report_every > 0 && last_report + report_every * 1e9 < next)
+			next = last_report + report_every * 1e9;
+
+		n = poll(fds, nfds, next == UINT64_MAX ? -1 : next <= t ? 0 : (int)((next - t + 999999) / 1000000));
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			break;
+		}
+
+		if (up_fd >= 0 && fds[up_fd].revents) {
+			int was_empty = !tx.count;
+			p = ring_space(&tx, &len);
+			n = read(up, p, len);
+			if (n > 0) {
+				tx.count += n;
+				bytes_in += n;
+				// an idle line starts sending now, not whenever it last stopped
+				if (was_empty && wire_free < now_ns())
+					wire_free = now_ns();
+			}
+			else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+				upstream_eof = 1;  // the pty reports EIO once the command exits
+		}
+		if (in_fd >= 0 && fds[in_fd].revents) {
+			p = ring_space(&reverse, &len);
+			n = read(0, p, len);
+			if (n > 0)
+				reverse.count += n;
+			else if (n == 0)
+				stdin_eof = 1;
+		}
+	}
+
+	if (restore_tio)
+		tcsetattr(0, TCSANOW, &saved_tio);
+	if (stop_at < now_ns())
+		stopped_ns += (go_at < now_ns() ? go_at : now_ns()) - stop_at;
+	report(now_ns());
+	if (child)
+		kill(child, SIGHUP);
+	return 0;
+}
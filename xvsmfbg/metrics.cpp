@@ -0,0 +1,178 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+#include "xvsmfbg.h"
+#include "metrics.h"
+#include "display.h"
+
+bool metrics_open( metrics_sink& sink, const char* arg, double start ) {
+	string text = arg;
+	size_t comma = text.find(',');
+	string path = text.substr(0, comma);
+
+	sink.frames = false;
+	while (comma != string::npos) {
+		size_t next = text.find(',', comma + 1);
+		string option = text.substr(comma + 1, next == string::npos ? string::npos : next - comma - 1);
+		if (option == "frames") {
+			sink.frames = true;
+		} else {
+			cerr << "Don't understand \"" << option << "\" in " << arg << endl;
+			return false;
+		}
+		comma = next;
+	}
+
+	sink.socket = path != "-";
+	sink.fd = 2;
+	if (sink.socket) {
+		if (path.size() >= sizeof(sink.to.sun_path)) {
+			cerr << "The socket path " << path << " is too long." << endl;
+			return false;
+		}
+		memset(&sink.to, 0, sizeof(sink.to));
+		sink.to.sun_family = AF_UNIX;
+		strcpy(sink.to.sun_path, path.c_str());
+		sink.fd = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+		if (sink.fd == -1) {
+			cerr << "Error making a socket for the metrics: ";
+			perror(NULL);
+			return false;
+		}
+	}
+	sink.start = sink.last = start;
+	sink.lost = 0;
+	return true;
+}
+
+// Nothing that goes wrong here is worth holding anything else up for, so there's just a count.
+static void emit( metrics_sink& sink, const string& line ) {
+	ssize_t done;
+
+	if (sink.socket)
+		done = sendto(sink.fd, line.data(), line.size(), MSG_DONTWAIT, (struct sockaddr*) &sink.to, sizeof(sink.to));
+	else
+		done = write(sink.fd, line.data(), line.size());
+	if (done != (ssize_t) line.size())
+		sink.lost++;
+}
+
+// Names are paths and the like; anything that would need escaping beyond quotes and backslashes goes.
+static string quoted( const string& text ) {
+	string out = "\"";
+	for (size_t ii = 0; ii < text.size(); ii++) {
+		if (text[ii] == '"' || text[ii] == '\\')
+			out += '\\';
+		if ((unsigned char) text[ii] >= ' ')
+			out += text[ii];
+	}
+	return out + "\"";
+}
+
+void metrics_frame( metrics_sink& sink, const display& disp, const string& output, const frame_times& times ) {
+	if (!sink.frames)
+		return;
+
+	stringstream line;
+	line.setf(ios::fixed);
+	line.precision(6);
+	line << "{\"type\":\"frame\",\"display\":" << quoted(disp.name) << ",\"output\":" << quoted(output)
+	     << ",\"frame\":" << times.frame
+	     << ",\"looked\":" << times.looked - sink.start << ",\"captured\":" << times.captured - sink.start
+	     << ",\"converted\":" << times.converted - sink.start << ",\"encoded\":" << times.encoded - sink.start
+	     << ",\"started\":" << times.started - sink.start << ",\"written\":" << times.written - sink.start << "}\n";
+	emit(sink, line.str());
+}
+
+// "name":[p50,p99] in milliseconds, and starting the counter's recent ones again.
+static void percentiles( stringstream& line, const char* name, stage_counter& counter, bool first = false ) {
+	line << (first ? "" : ",") << "\"" << name << "\":[" << counter_percentile(counter, 50) * 1000
+	     << "," << counter_percentile(counter, 99) * 1000 << "]";
+	counter_roll(counter);
+}
+
+void metrics_rollup( metrics_sink& sink, vector<display>& displays, const display_settings& settings, double t ) {
+	double elapsed = t - sink.last;
+
+	if (sink.captured.size() != displays.size()) {
+		sink.captured.assign(displays.size(), 0);
+		sink.dropped.assign(displays.size(), 0);
+		sink.frames_sent.resize(displays.size());
+		sink.superseded.resize(displays.size());
+		sink.bytes.resize(displays.size());
+		sink.busy.resize(displays.size());
+		for (size_t ii = 0; ii < displays.size(); ii++) {
+			sink.frames_sent[ii].assign(displays[ii].outputs.size(), 0);
+			sink.superseded[ii].assign(displays[ii].outputs.size(), 0);
+			sink.bytes[ii].assign(displays[ii].outputs.size(), 0);
+			sink.busy[ii].assign(displays[ii].outputs.size(), 0);
+		}
+	}
+
+	for (size_t ii = 0; ii < displays.size(); ii++) {
+		display& disp = displays[ii];
+		long captured = disp.frame, sent = 0, skipped = 0;
+		long long bytes = 0;
+		stringstream outputs;
+
+		outputs.setf(ios::fixed);
+		outputs.precision(3);
+		for (size_t jj = 0; jj < disp.outputs.size(); jj++) {
+			output& out = disp.outputs[jj];
+			long out_sent = out.frames - sink.frames_sent[ii][jj], out_skipped = out.superseded - sink.superseded[ii][jj];
+			long long out_bytes = out.bytes - sink.bytes[ii][jj];
+			double busy = out.busy - sink.busy[ii][jj];
+
+			outputs << (jj ? "," : "") << "{\"name\":" << quoted(out.name) << ",\"sent\":" << out_sent
+			        << ",\"skipped\":" << out_skipped << ",\"bytes\":" << out_bytes
+			        << ",\"busy\":" << (elapsed > 0 ? busy / elapsed : 0) << ",\"rate\":";
+			// Only the pacer ever finds out the rate; otherwise it's just the guess it started with.
+			if (out.ring || out.use_credit)
+				outputs << "null";
+			else
+				outputs << (long) out.pacer.rate;
+			outputs << ",\"dead\":" << (out.dead ? "true" : "false") << "}";
+			sent += out_sent;
+			skipped += out_skipped;
+			bytes += out_bytes;
+			sink.frames_sent[ii][jj] = out.frames;
+			sink.superseded[ii][jj] = out.superseded;
+			sink.bytes[ii][jj] = out.bytes;
+			sink.busy[ii][jj] = out.busy;
+		}
+
+		const screen_area& area = disp.filter.area;
+		double screen_bytes = (double) sent * area.width * area.height * disp.xwd.bits_per_pixel / 8;
+
+		stringstream line;
+		line.setf(ios::fixed);
+		line.precision(3);
+		line << "{\"type\":\"second\",\"t\":" << t - sink.start << ",\"display\":" << quoted(disp.name)
+		     << ",\"captured\":" << captured - sink.captured[ii] << ",\"dropped\":" << disp.dropped - sink.dropped[ii]
+		     << ",\"sent\":" << sent << ",\"skipped\":" << skipped << ",\"bytes\":" << bytes
+		     << ",\"ratio\":" << (bytes ? screen_bytes / bytes : 0)
+		     << ",\"poll_ms\":" << settings.poll_interval * 1000 << ",\"ms\":{";
+		percentiles(line, "capture", disp.capture_time, true);
+		percentiles(line, "convert_wait", disp.convert_wait);
+		percentiles(line, "convert", disp.convert_time);
+		percentiles(line, "encode_wait", disp.encode_wait);
+		percentiles(line, "encode", disp.encode_time);
+		percentiles(line, "transmit_wait", disp.transmit_wait);
+		percentiles(line, "write", disp.write_time);
+		percentiles(line, "total", disp.total_time);
+		line << "},\"outputs\":[" << outputs.str() << "]}\n";
+		emit(sink, line.str());
+
+		sink.captured[ii] = captured;
+		sink.dropped[ii] = disp.dropped;
+	}
+	sink.last = t;
+}
+
+void metrics_close( metrics_sink& sink ) {
+	if (sink.socket)
+		close(sink.fd);
+}
@@ -0,0 +1,64 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+// Figures for programs rather than people: a JSON object a line, to stderr or as datagrams to a
+// Unix socket.  Every second, one for each screen:
+//
+//   {"type":"second","t":12.000,"display":"stdin","captured":20,"dropped":1,"sent":6,"skipped":14,
+//    "bytes":86400,"ratio":53.33,"poll_ms":10,"ms":{"capture":[0.41,0.88],...},"outputs":[...]}
+//
+// where "ms" has the 50th and 99th percentile time, over the frames that second, that frames spent
+// in each stage and queue (see pipeline.h) and, for the ones written, writing and altogether since
+// the change was seen.  "ratio" is how many bytes of screen went for each byte written.  Each
+// output has what it sent, skipped and wrote, how much of the second it spent writing ("busy") and,
+// if it's paced by rate rather than credit, the rate in bytes a second (otherwise null).
+// With frames, also one for each frame each output has written:
+//
+//   {"type":"frame","display":"stdin","output":"/dev/ttyUSB0","frame":42,"looked":11.962,...}
+//
+// Times are seconds since xvsmfbg started.
+
+#ifndef _XVSMFBG_METRICS_
+#define _XVSMFBG_METRICS_
+
+#include "pipeline.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <vector>
+
+struct display;
+struct display_settings;
+
+struct metrics_sink {
+	int fd;                  // stderr, or our socket
+	struct sockaddr_un to;   // where the datagrams go, with a socket
+	bool socket;
+	bool frames;             // a line for every frame written, too
+	double start, last;
+	long lost;               // lines that couldn't be sent
+
+	// What the counts were at the last rollup, by display and output.
+	std::vector<long> captured, dropped;
+	std::vector<std::vector<long> > frames_sent, superseded;
+	std::vector<std::vector<long long> > bytes;
+	std::vector<std::vector<double> > busy;
+};
+
+// Parses "-[,frames]" for stderr or "path[,frames]" for a Unix datagram socket, which something else
+// has to have bound.  Returns false, having said why, if it can't.
+bool metrics_open( metrics_sink& sink, const char* arg, double start );
+
+// The per-frame line, if it's wanted.
+void metrics_frame( metrics_sink& sink, const display& disp, const std::string& output, const frame_times& times );
+
+// The lines for the second since the last one, and starting again.
+void metrics_rollup( metrics_sink& sink, std::vector<display>& displays, const display_settings& settings, double t );
+
+void metrics_close( metrics_sink& sink );
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+#include "xvsmfbg.h"
+#include "output.h"
+#include "serial.h"
+#include "ring.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+#define OPEN_RETRY 0.1   // seconds between tries at a fifo with nobody reading it
+
+bool parse_output( const char* arg, const output_spec& defaults, output_spec& spec ) {
+	string text = arg;
+	size_t comma = text.find(',');
+
+	spec = defaults;
+	spec.path = text.substr(0, comma);
+	while (comma != string::npos) {
+		size_t next = text.find(',', comma + 1);
+		string option = text.substr(comma + 1, next == string::npos ? string::npos : next - comma - 1);
+		size_t equals = option.find('=');
+		string key = option.substr(0, equals), value = equals == string::npos ? "" : option.substr(equals + 1);
+
+		if (key == "baud" && atoi(value.c_str()) > 0)
+			spec.baud = atoi(value.c_str());
+		else if (key == "rtscts" && value.empty())
+			spec.rtscts = true;
+		else if (key == "credit" && !value.empty())
+			spec.credit = value;
+		else if (key == "window" && atoi(value.c_str()) > 0)
+			spec.window = atoi(value.c_str());
+		else if (key == "rate" && atof(value.c_str()) > 0)
+			spec.rate = atof(value.c_str());
+		else if (key == "fps" && atof(value.c_str()) >= 0)
+			spec.fps = atof(value.c_str());
+		else if (key == "slots" && atoi(value.c_str()) >= 2)
+			spec.slots = atoi(value.c_str());
+		else {
+			cerr << "Don't understand \"" << option << "\" in " << arg << endl;
+			return false;
+		}
+		comma = next;
+	}
+	if (spec.path.empty()) {
+		cerr << "No path in " << arg << endl;
+		return false;
+	}
+	return true;
+}
+
+bool output_open( output& out, const output_spec& spec ) {
+	struct stat st;
+	double rate = spec.rate;
+
+	out.name = spec.path == "-" ? "stdout" : spec.path;
+	out.path = spec.path;
+	out.ring = NULL;
+	out.waiting = false;
+	if (!spec.path.compare(0, 4, "shm:")) {
+		// Always ready, and never anything to wait for.
+		out.ring = new frame_ring;
+		if (!ring_create(*out.ring, spec.path.c_str() + 4, spec.slots)) {
+			delete out.ring;
+			out.ring = NULL;
+			return false;
+		}
+		out.fd = -1;
+	} else if (spec.path == "-") {
+		out.fd = 1;
+	} else if (stat(spec.path.c_str(), &st) == 0 && S_ISCHR(st.st_mode)) {
+		// Read and write, for credit coming back up a serial port.
+		out.fd = open(spec.path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+		if (out.fd != -1 && isatty(out.fd)) {
+			if (!serial_setup(out.fd, spec.path.c_str(), spec.baud, spec.rtscts))
+				return false;
+			// a serial port goes at the rate we set it to
+			rate = spec.baud / 10.0;
+		}
+	} else {
+		// Non-blocking, so a fifo with nobody reading it yet doesn't stop us either.  That fails
+		// with ENXIO, and it waits, without holding up anything else, until there's a reader.
+		out.fd = open(spec.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC, 0666);
+		if (out.fd == -1 && errno == ENXIO) {
+			cerr << "Nobody is reading " << spec.path << " yet; it'll get frames once something is." << endl;
+			out.waiting = true;
+			out.retry = now() + OPEN_RETRY;
+		}
+	}
+	if (out.fd == -1 && !out.ring && !out.waiting) {
+		cerr << "Can't open " << spec.path << ": ";
+		perror(NULL);
+		return false;
+	}
+	// Never wait on any one output.
+	if (out.fd != -1)
+		fcntl(out.fd, F_SETFL, fcntl(out.fd, F_GETFL) | O_NONBLOCK);
+
+	out.use_credit = !spec.credit.empty() && !out.ring;
+	if (spec.credit == "-")
+		credit_attach(out.credit, out.fd, spec.window);
+	else if (out.use_credit && !credit_open(out.credit, spec.credit.c_str(), spec.window))
+		return false;
+	pacer_init(out.pacer, out.fd, rate);
+
+	out.min_interval = spec.fps > 0 ? 1 / spec.fps : 0;
+	out.frame = 0;
+	out.sent = out.allowed = FRAME_BYTES;
+	out.started = -1e9;
+	out.blocked = out.dead = false;
+	out.frames = out.superseded = 0;
+	out.bytes = 0;
+	out.busy = 0;
+	out.written = 0;
+	return true;
+}
+
+void output_close( output& out ) {
+	if (out.ring) {
+		ring_close(*out.ring);
+		delete out.ring;
+		out.ring = NULL;
+	}
+	if (out.fd > 2)
+		close(out.fd);
+	out.fd = -1;
+}
+
+// Another go at a fifo that had nobody reading it.
+static void output_reopen( output& out, double t ) {
+	if (t < out.retry)
+		return;
+	out.fd = open(out.path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+	if (out.fd == -1) {
+		if (errno == ENXIO) {
+			out.retry = t + OPEN_RETRY;
+		} else {
+			cerr << "Giving up on " << out.name << ": ";
+			perror(NULL);
+			out.dead = true;
+		}
+		return;
+	}
+	out.waiting = false;
+	pacer_init(out.pacer, out.fd, out.pacer.rate);
+	if (out.use_credit && out.credit.fd == -1)
+		credit_attach(out.credit, out.fd, out.credit.window);
+}
+
+void output_update( output& out, double t ) {
+	if (out.dead || out.ring)
+		return;
+	if (out.waiting) {
+		output_reopen(out, t);
+		if (out.waiting)
+			return;
+	}
+	if (out.use_credit)
+		credit_collect(out.credit);
+	else
+		pacer_update(out.pacer, t);
+
+	// Spend whatever credit it has on the rest of its frame.
+	if (out.use_credit && out.allowed < FRAME_BYTES && out.credit.credits > 0) {
+		int rows = (FRAME_BYTES - out.allowed) / ROW_BYTES;
+		if (rows > out.credit.credits)
+			rows = out.credit.credits;
+		out.credit.credits -= rows;
+		out.allowed += rows * ROW_BYTES;
+	}
+}
+
+bool output_ready( const output& out, double t, double lead ) {
+	if (out.dead || out.waiting || out.sent < FRAME_BYTES || t - out.started < out.min_interval)
+		return false;
+	if (out.ring)
+		return true;
+	return out.use_credit ? out.credit.credits > 0 : pacer_ready(out.pacer, lead);
+}
+
+void output_start( output& out, long n, const unsigned char* bits, double t ) {
+	if (out.frame)
+		out.superseded += n - out.frame - 1;
+	out.frame = n;
+	out.started = t;
+	out.frames++;
+
+	// Straight into the ring, and done.
+	if (out.ring) {
+		ring_publish(*out.ring, n, bits, t);
+		out.sent = out.allowed = FRAME_BYTES;
+		out.bytes += FRAME_BYTES;
+		out.written = now();
+		out.busy += out.written - t;
+		return;
+	}
+
+	memcpy(out.bits, bits, FRAME_BYTES);
+	out.sent = 0;
+	out.allowed = out.use_credit ? 0 : FRAME_BYTES;
+	out.written = 0;
+	output_update(out, t);
+}
+
+void output_send( output& out ) {
+	out.blocked = false;
+	if (out.dead || out.sent >= out.allowed)
+		return;
+
+	ssize_t written = write(out.fd, out.bits + out.sent, out.allowed - out.sent);
+	if (written > 0) {
+		out.sent += written;
+		out.bytes += written;
+		if (!out.use_credit)
+			pacer_wrote(out.pacer, written);
+		out.blocked = out.sent < out.allowed;
+		if (out.sent == FRAME_BYTES) {
+			out.written = now();
+			out.busy += out.written - out.started;
+		}
+	} else if (written == 0 || errno == EAGAIN || errno == EINTR) {
+		out.blocked = true;
+	} else {
+		cerr << "Giving up on " << out.name << ": ";
+		perror(NULL);
+		out.dead = true;
+	}
+}
+
+bool output_busy( const output& out ) {
+	if (out.dead)
+		return false;
+	return out.sent < out.allowed ? !out.blocked
+		: out.use_credit && out.credit.credits > 0 && out.allowed < FRAME_BYTES;
+}
+
+int output_pollfds( const output& out, struct pollfd* fds ) {
+	int n = 0;
+
+	if (out.dead)
+		return 0;
+	if (out.blocked) {
+		fds[n].fd = out.fd;
+		fds[n++].events = POLLOUT;
+	}
+	if (out.use_credit) {
+		fds[n].fd = out.credit.fd;
+		fds[n++].events = POLLIN;
+	}
+	return n;
+}
@@ -0,0 +1,92 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+// The places frames go: stdout, serial ports, pipes and files, each going at its own pace.
+// A frame is converted once and every output that's ready for one gets a copy of the newest;
+// one that's slow, stuck or gone never holds up the rest.
+
+#ifndef _XVSMFBG_OUTPUT_
+#define _XVSMFBG_OUTPUT_
+
+#include "capture.h"
+
+#include <string>
+
+#define FRAME_BYTES (OUTPUT_WIDTH * OUTPUT_HEIGHT / 8)
+#define ROW_BYTES   (OUTPUT_WIDTH / 8)
+
+struct frame_ring;
+
+// How to open one.  path "-" is stdout; a tty is opened as a serial port at baud; "shm:/name" is
+// a ring of slots frames in POSIX shared memory (see ring.h).
+struct output_spec {
+	std::string path;
+	int baud;
+	bool rtscts;
+	std::string credit;      // fifo the far end sends credit down, "-" for the port itself, or empty for none
+	int window;              // rows, with credit
+	double rate;             // bytes/s to start guessing the link rate from, without credit
+	double fps;              // at most this many frames a second, or 0 for as many as it takes
+	int slots;               // in a ring
+};
+
+struct output {
+	std::string name;
+	int fd;                  // -1 while waiting
+	bool waiting;            // for a fifo's reader to turn up, to open it
+	double retry;            // when to try opening it again, while waiting
+	std::string path;
+	bool use_credit;
+	link_pacer pacer;
+	credit_link credit;
+	double min_interval;     // between frames, from fps
+	frame_ring* ring;        // frames go here instead of fd, or NULL
+
+	unsigned char bits[FRAME_BYTES];
+	long frame;              // which frame bits holds, 0 for none yet
+	size_t sent;             // bytes of it written...
+	size_t allowed;          // ...and how many we may write so far
+	double started;          // when it started on bits
+	bool blocked;            // the last write didn't get everything out
+	bool dead;               // gone; we've stopped trying
+
+	double written;          // when all of bits had been written, or 0 if it hasn't yet
+
+	long frames;             // sent, or started on
+	long superseded;         // frames it never got because it was busy with an older one
+	long long bytes;         // written altogether
+	double busy;             // seconds from starting frames to having written them
+};
+
+// Parses "path[,key=value...]" on top of defaults: keys are baud, rtscts, credit, window, rate, fps and slots.
+// Returns false, having said why, if it can't.
+bool parse_output( const char* arg, const output_spec& defaults, output_spec& spec );
+
+// Opens it non-blocking.  A fifo nobody's reading yet waits, and output_update() keeps trying it.
+// Returns false, having said why, if it can't.
+bool output_open( output& out, const output_spec& spec );
+
+void output_close( output& out );
+
+// Collects credit, or updates the rate guess, or tries opening it again if it's waiting.
+void output_update( output& out, double t );
+
+// Whether it's between frames and its link can take a new one.
+bool output_ready( const output& out, double t, double lead );
+
+// Starts it on frame number n, in bits.
+void output_start( output& out, long n, const unsigned char* bits, double t );
+
+// Writes what it can of its frame without waiting.  Marks it dead if the far end has gone.
+void output_send( output& out );
+
+// Whether there's more it could do right now without waiting.
+bool output_busy( const output& out );
+
+// What to poll it for: fills in up to two entries of fds and returns how many.
+int output_pollfds( const output& out, struct pollfd* fds );
+
+#endif
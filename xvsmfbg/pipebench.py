@@ -0,0 +1,549 @@
+#! /usr/bin/env python3
+
+# End to end benchmark: a source, the serial line (emulator/tc_link) and the device, timed from a
+# change on the source's screen to its arrival at the device.
+#
+#   pipebench.py xwd  [options]   xvsmfbg grabbing synthetic frames out of a shared memory XWD, like
+#                                 Xvfb's, into emulator/tc_emulator_headless
+#   pipebench.py term [options]   a shell on a pty running a scripted workload, into the terminal
+#                                 emulator (Source Code/host/emulator-headless)
+#   pipebench.py fanout [options] xvsmfbg sending to more and more fifos at once; how much CPU
+#                                 each one costs it
+#   pipebench.py replay [options] xvsmfbg recording synthetic frames, then replaying them (fast)
+#                                 into emulator/tc_emulator_headless; checks every frame gets there
+#
+#   --baud N          link rate (921600)
+#   --link "args"     anything else for tc_link, e.g. "-rxbuf 254 -drain 20000"
+#   --seconds N       how long to run the source for (10)
+#   --fps N           xwd: source updates a second (10)
+#   --change F        xwd: fraction of the screen each update changes (0.1)
+#   --credit          xwd, replay: the device gives xvsmfbg credit back for every row it takes
+#   --window N        xwd, replay: ...and xvsmfbg starts with N rows' worth (16)
+#   --clients N,N..   fanout: how many clients to try (1,2,4,8,16)
+#   --stalled         fanout: one more client that never reads
+#   --script file     term: commands to run, one per line (a built in list otherwise)
+#   -o file           where to write the report (stdout)
+#
+# xwd stamps a counter into the top left 32 pixels of every update and watches for it in the
+# frames coming off the link; term follows every command with a marker and watches for that.
+# bytes_per_updated_pixel counts the pixels that differ between successive frames the device got.
+# Arrival is when the bytes reach the device, so the device's own drawing time (in "device" in
+# the report) comes on top.  The report is JSON, so runs before and after a change can be compared.
+# Build xvsmfbg, tc_link ("make link") and the headless emulator(s) first.
+
+import sys, os, time, json, re, struct, signal, threading, subprocess, argparse, ctypes, tempfile
+
+here = os.path.dirname(os.path.abspath(__file__))
+
+WIDTH, HEIGHT = 480, 240
+FRAME_BYTES = WIDTH * HEIGHT // 8
+
+# What Xvfb -shmem puts in front of the pixels for 480x240x8, laid out like its XWD header: a 100
+# byte header, the window name, and a 256 entry colormap.  xvsmfbg reads the sizes from the header.
+XWD_NAME = b"Xvfb main window".ljust(60, b"\0")
+XWD_HEADER_SIZE = 100 + len(XWD_NAME)
+XWD_OFFSET = XWD_HEADER_SIZE + 256 * 12
+
+DEFAULT_SCRIPT = [
+	"ls -l /usr/bin | head -60",
+	"seq 1 400",
+	"head -c 6000 /etc/services",
+	"ps ax | head -40",
+	"cat /etc/passwd",
+	"for i in 1 2 3 4 5 6 7 8; do printf '\\033[7m%078d\\033[0m\\n' $i; done",
+]
+
+def percentiles(values):
+	if not values:
+		return None
+	v = sorted(values)
+	pick = lambda p: v[min(len(v) - 1, int(p * len(v)))]
+	return {"mean": round(sum(v) / len(v), 2), "p50": round(pick(0.5), 2), "p90": round(pick(0.9), 2),
+		"p99": round(pick(0.99), 2), "max": round(v[-1], 2)}
+
+def link_stats(text):
+	# the last report line tc_link printed
+	lines = [l for l in text.splitlines() if " in " in l and " sent " in l]
+	if not lines:
+		return None
+	stats = {"report": lines[-1]}
+	for name in ("in", "sent", "out", "dropped"):
+		m = re.search(r"\b%s (\d+)" % name, lines[-1])
+		if m:
+			stats[name] = int(m.group(1))
+	m = re.search(r"link ([\d.]+)% busy", lines[-1])
+	if m:
+		stats["busy_percent"] = float(m.group(1))
+	return stats
+
+def device_stats(text):
+	m = re.search(r"(\d+) frames in ([\d.]+) s: ([\d.]+) frames/s", text)
+	stats = {"report": text.strip().splitlines()[-1] if text.strip() else ""}
+	if m:
+		stats["frames"], stats["frames_per_s"] = int(m.group(1)), float(m.group(3))
+	return stats
+
+class Tap(threading.Thread):
+	# Sits between the link and the device: passes everything on, and notes when things arrive.
+	def __init__(self, src, dst, on_data):
+		threading.Thread.__init__(self)
+		self.daemon = True
+		self.src, self.dst, self.on_data = src, dst, on_data
+		self.bytes = 0
+
+	def run(self):
+		while True:
+			data = os.read(self.src.fileno(), 65536)
+			if not data:
+				break
+			t = time.monotonic()
+			self.bytes += len(data)
+			try:
+				self.dst.write(data)
+				self.dst.flush()
+			except BrokenPipeError:
+				break
+			self.on_data(data, t)
+		try:
+			self.dst.close()
+		except BrokenPipeError:
+			pass
+
+def start_link(args, extra, stdin=subprocess.PIPE, stdout=subprocess.PIPE):
+	cmd = [args.tc_link, "-baud", str(args.baud)] + args.link.split() + extra
+	return subprocess.Popen(cmd, stdin=stdin, stdout=stdout, stderr=subprocess.PIPE)
+
+def finish(proc, timeout=10):
+	# wait for it to exit and return what it said on stderr
+	try:
+		proc.wait(timeout)
+	except subprocess.TimeoutExpired:
+		proc.kill()
+		proc.wait()
+	return proc.stderr.read().decode(errors="replace") if proc.stderr else ""
+
+##### xvsmfbg with synthetic frames
+
+class Shm:
+	IPC_PRIVATE, IPC_CREAT, IPC_RMID = 0, 0o1000, 0
+
+	def __init__(self, size):
+		self.libc = ctypes.CDLL(None, use_errno=True)
+		self.libc.shmat.restype = ctypes.c_void_p
+		self.libc.shmdt.argtypes = [ctypes.c_void_p]
+		self.id = self.libc.shmget(self.IPC_PRIVATE, ctypes.c_size_t(size), self.IPC_CREAT | 0o600)
+		if self.id < 0:
+			raise OSError(ctypes.get_errno(), "shmget")
+		self.addr = self.libc.shmat(self.id, None, 0)
+		if self.addr in (None, ctypes.c_void_p(-1).value):
+			raise OSError(ctypes.get_errno(), "shmat")
+
+	def write(self, offset, data):
+		ctypes.memmove(self.addr + offset, data, len(data))
+
+	def close(self):
+		self.libc.shmdt(ctypes.c_void_p(self.addr))
+		self.libc.shmctl(self.id, self.IPC_RMID, None)
+
+def xwd_header():
+	# native byte order, like the server writes it; a grey colormap so 0 is black and 255 is white
+	fields = [XWD_HEADER_SIZE, 7, 2, 8, WIDTH, HEIGHT, 0, 0, 32, 0, 32, 8, WIDTH, 3, 0, 0, 0, 8, 256, 256,
+		WIDTH, HEIGHT, 0, 0, 0]
+	header = struct.pack("=25I", *fields) + XWD_NAME
+	colormap = b"".join(struct.pack("=I3HBB", i, i * 257, i * 257, i * 257, 7, 0) for i in range(256))
+	return header + colormap
+
+def stamp(img, k):
+	# 16 bit counter and its complement, a bit a pixel, MSB first, across the top left 32 pixels
+	word = ((k & 0xFFFF) << 16) | (~k & 0xFFFF)
+	for i in range(32):
+		img[i] = 255 if word & (0x80000000 >> i) else 0
+
+def read_stamp(frame):
+	hi, lo, nhi, nlo = frame[0], frame[1], frame[2], frame[3]
+	if hi ^ nhi != 0xFF or lo ^ nlo != 0xFF:
+		return None
+	return (hi << 8) | lo
+
+def changed_pixels(a, b):
+	# frames as they come off the link, a bit a pixel
+	return bin(int.from_bytes(a, "big") ^ int.from_bytes(b, "big")).count("1")
+
+def update_screen(shm, img, k, band):
+	# invert the next band of rows, working down the screen
+	top = (k * band) % HEIGHT
+	for y in range(top, min(HEIGHT, top + band)):
+		row = y * WIDTH
+		img[row:row + WIDTH] = bytes(255 - p for p in img[row:row + WIDTH])
+	stamp(img, k)
+	shm.write(XWD_OFFSET + 32, bytes(img[32:]))
+	shm.write(XWD_OFFSET, bytes(img[:32]))  # stamp last, so it never runs ahead of the picture
+
+def run_xwd(args):
+	shm = Shm(XWD_OFFSET + WIDTH * HEIGHT)
+	sent = {}          # update number -> when it was made
+	arrived = {}       # update number -> when it reached the device
+	frames = {"count": 0, "corrupt": 0, "pixels": 0, "last": bytes(FRAME_BYTES)}
+	pending = bytearray()
+	lock = threading.Lock()
+
+	def on_data(data, t):
+		pending.extend(data)
+		while len(pending) >= FRAME_BYTES:
+			frame = bytes(pending[:FRAME_BYTES])
+			del pending[:FRAME_BYTES]
+			k = read_stamp(frame)
+			frames["count"] += 1
+			frames["pixels"] += changed_pixels(frames["last"], frame)
+			frames["last"] = frame
+			with lock:
+				if k is None:
+					frames["corrupt"] += 1
+					continue
+				# the most recent update with these low 16 bits
+				matches = [n for n in sent if n & 0xFFFF == k]
+				if matches and max(matches) not in arrived:
+					arrived[max(matches)] = t
+
+	try:
+		shm.write(0, xwd_header())
+		img = bytearray(WIDTH * HEIGHT)
+		stamp(img, 0)
+		shm.write(XWD_OFFSET, bytes(img))
+		sent[0] = time.monotonic()
+
+		device_args, grabber_args = [], []
+		if args.credit:
+			# credit goes straight back, not through tc_link: it's a byte a row
+			fifo = os.path.join(tempfile.mkdtemp(), "credit")
+			os.mkfifo(fifo)
+			device_args = ["-credit", fifo]
+			grabber_args = ["-credit", fifo] + (["-window", str(args.window)] if args.window else [])
+		device = subprocess.Popen([args.device, "-headless"] + device_args, stdin=subprocess.PIPE,
+			stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+		grabber = subprocess.Popen([args.xvsmfbg] + grabber_args, stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+			stderr=subprocess.DEVNULL)
+		link = start_link(args, [], stdin=grabber.stdout)
+		grabber.stdout.close()
+		grabber.stdin.write(b"screen 0 shmid %d\n" % shm.id)
+		grabber.stdin.close()
+		tap = Tap(link.stdout, device.stdin, on_data)
+		tap.start()
+
+		band = max(1, int(HEIGHT * args.change))
+		start = time.monotonic()
+		k = 0
+		while time.monotonic() - start < args.seconds:
+			k += 1
+			time.sleep(max(0, start + k / args.fps - time.monotonic()))
+			update_screen(shm, img, k, band)
+			with lock:
+				sent[k] = time.monotonic()
+		elapsed = time.monotonic() - start
+
+		# give the last update time to get through, then wind everything down
+		deadline = time.monotonic() + args.settle
+		while k not in arrived and time.monotonic() < deadline:
+			time.sleep(0.05)
+		grabber.send_signal(signal.SIGINT)
+		finish(grabber)
+		link_err = finish(link)
+		tap.join(5)
+		device_err = finish(device)
+	finally:
+		shm.close()
+
+	latencies = [(arrived[n] - sent[n]) * 1000 for n in arrived if n > 0]
+	pixels = frames["pixels"]
+	updates = len(sent) - 1
+	return {
+		"mode": "xwd",
+		"baud": args.baud,
+		"link_args": args.link,
+		"credit": args.credit,
+		"window": args.window,
+		"seconds": round(elapsed, 3),
+		"updates": updates,
+		"updates_delivered": len(latencies),
+		"updates_skipped": updates - len(latencies),
+		"updates_per_s": round(len(latencies) / elapsed, 2),
+		"latency_ms": percentiles(latencies),
+		"frames": frames["count"],
+		"frames_per_s": round(frames["count"] / elapsed, 2),
+		"corrupt_frames": frames["corrupt"],
+		"link_bytes": tap.bytes,
+		"bytes_per_updated_pixel": round(tap.bytes / pixels, 3) if pixels else None,
+		"link": link_stats(link_err),
+		"device": device_stats(device_err),
+	}
+
+##### xvsmfbg fanning out to many clients
+
+def run_fanout(args):
+	# Each client is a fifo with cat emptying it as fast as it fills; --stalled adds one nobody
+	# reads, which mustn't slow down the rest.  What we measure is xvsmfbg's own CPU time.
+	counts = [int(n) for n in args.clients.split(",")]
+	band = max(1, int(HEIGHT * args.change))
+	runs = []
+
+	for n in counts:
+		shm = Shm(XWD_OFFSET + WIDTH * HEIGHT)
+		tmp = tempfile.mkdtemp()
+		readers, stalled = [], None
+		fifos = [os.path.join(tmp, "client%d" % i) for i in range(n + (1 if args.stalled else 0))]
+		try:
+			for f in fifos:
+				os.mkfifo(f)
+			for f in fifos[:n]:
+				readers.append(subprocess.Popen("exec cat %s > /dev/null" % f, shell=True))
+			if args.stalled:
+				stalled = os.open(fifos[n], os.O_RDONLY | os.O_NONBLOCK)
+
+			shm.write(0, xwd_header())
+			img = bytearray(WIDTH * HEIGHT)
+			shm.write(XWD_OFFSET, bytes(img))
+			cmd = [args.xvsmfbg]
+			for f in fifos:
+				cmd += ["-out", f]
+			grabber = subprocess.Popen(cmd, stdin=subprocess.PIPE, stderr=subprocess.PIPE)
+			grabber.stdin.write(b"screen 0 shmid %d\n" % shm.id)
+			grabber.stdin.close()
+
+			start = time.monotonic()
+			k = 0
+			while time.monotonic() - start < args.seconds:
+				k += 1
+				time.sleep(max(0, start + k / args.fps - time.monotonic()))
+				update_screen(shm, img, k, band)
+			time.sleep(0.5)
+			elapsed = time.monotonic() - start
+
+			grabber.send_signal(signal.SIGINT)
+			_, _, usage = os.wait4(grabber.pid, 0)
+			grabber.returncode = 0
+			err = grabber.stderr.read().decode(errors="replace")
+		finally:
+			for r in readers:
+				r.kill()
+				r.wait()
+			if stalled is not None:
+				os.close(stalled)
+			shm.close()
+
+		sent = [int(m) for m in re.findall(r"client\d+: sent (\d+) frames", err)]
+		cpu = usage.ru_utime + usage.ru_stime
+		runs.append({
+			"clients": n,
+			"updates": k,
+			"cpu_percent": round(cpu / elapsed * 100, 2),
+			"cpu_ms_per_update": round(cpu * 1000 / k, 3),
+			"frames_per_client": sent[:n],
+			"stalled_client_frames": sent[n] if args.stalled and len(sent) > n else None,
+		})
+
+	# what each client past the first costs, from a straight line through the runs
+	per_client = None
+	if len(runs) > 1:
+		xs = [r["clients"] for r in runs]
+		ys = [r["cpu_ms_per_update"] for r in runs]
+		mx, my = sum(xs) / len(xs), sum(ys) / len(ys)
+		sxx = sum((x - mx) ** 2 for x in xs)
+		if sxx:
+			per_client = round(sum((x - mx) * (y - my) for x, y in zip(xs, ys)) / sxx, 4)
+	return {
+		"mode": "fanout",
+		"fps": args.fps,
+		"seconds": args.seconds,
+		"stalled": args.stalled,
+		"runs": runs,
+		"cpu_ms_per_update_per_client": per_client,
+	}
+
+##### Replaying a recording
+
+def run_replay(args):
+	# Record --fps updates a second for --seconds, then play them back as fast as the link and
+	# (with --credit) the device allow.  xvsmfbg quits by itself once the last frame is sent, so
+	# what arrives has to be exactly what it says it sent, ending on the last update.
+	shm = Shm(XWD_OFFSET + WIDTH * HEIGHT)
+	tmp = tempfile.mkdtemp()
+	rec = os.path.join(tmp, "replay.rec")
+	band = max(1, int(HEIGHT * args.change))
+	frames = {"count": 0, "corrupt": 0, "last": None}
+	pending = bytearray()
+
+	def on_data(data, t):
+		pending.extend(data)
+		while len(pending) >= FRAME_BYTES:
+			frame = bytes(pending[:FRAME_BYTES])
+			del pending[:FRAME_BYTES]
+			k = read_stamp(frame)
+			frames["count"] += 1
+			frames["last"] = k
+			if k is None:
+				frames["corrupt"] += 1
+
+	try:
+		shm.write(0, xwd_header())
+		img = bytearray(WIDTH * HEIGHT)
+		stamp(img, 0)
+		shm.write(XWD_OFFSET, bytes(img))
+		recorder = subprocess.Popen([args.xvsmfbg, "-display", "shmid=%d,record=%s" % (shm.id, rec),
+			"-out", "/dev/null,rate=1e9"], stderr=subprocess.DEVNULL)
+		time.sleep(0.3)
+		start = time.monotonic()
+		k = 0
+		while time.monotonic() - start < args.seconds:
+			k += 1
+			time.sleep(max(0, start + k / args.fps - time.monotonic()))
+			update_screen(shm, img, k, band)
+		time.sleep(0.3)
+		recorder.send_signal(signal.SIGINT)
+		finish(recorder)
+	finally:
+		shm.close()
+
+	device_args, grabber_args = [], []
+	if args.credit:
+		fifo = os.path.join(tmp, "credit")
+		os.mkfifo(fifo)
+		device_args = ["-credit", fifo]
+		grabber_args = ["-credit", fifo] + (["-window", str(args.window)] if args.window else [])
+	device = subprocess.Popen([args.device, "-headless"] + device_args, stdin=subprocess.PIPE,
+		stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+	start = time.monotonic()
+	grabber = subprocess.Popen([args.xvsmfbg] + grabber_args + ["-display", "replay=%s,fast" % rec, "-out", "-"],
+		stdin=subprocess.DEVNULL, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+	link = start_link(args, [], stdin=grabber.stdout)
+	grabber.stdout.close()
+	tap = Tap(link.stdout, device.stdin, on_data)
+	tap.start()
+	try:
+		grabber_err = grabber.communicate(timeout=args.settle + args.seconds * 10)[1].decode(errors="replace")
+	except subprocess.TimeoutExpired:
+		grabber.send_signal(signal.SIGINT)
+		grabber_err = grabber.communicate()[1].decode(errors="replace")
+	elapsed = time.monotonic() - start
+	link_err = finish(link)
+	tap.join(5)
+	device_err = finish(device)
+	os.unlink(rec)
+
+	m = re.search(r"stdout: sent (\d+) frames", grabber_err)
+	sent = int(m.group(1)) if m else None
+	return {
+		"mode": "replay",
+		"baud": args.baud,
+		"link_args": args.link,
+		"credit": args.credit,
+		"window": args.window,
+		"updates": k,
+		"seconds": round(elapsed, 3),
+		"exit_status": grabber.returncode,
+		"frames_sent": sent,
+		"frames": frames["count"],
+		"corrupt_frames": frames["corrupt"],
+		"partial_bytes": len(pending),
+		"last_update": frames["last"],
+		"complete": sent == frames["count"] and not pending and frames["last"] == k & 0xFFFF,
+		"link_bytes": tap.bytes,
+		"link": link_stats(link_err),
+		"device": device_stats(device_err),
+	}
+
+##### A shell on a pty
+
+def run_term(args):
+	script = DEFAULT_SCRIPT
+	if args.script:
+		script = [l.rstrip("\n") for l in open(args.script) if l.strip()]
+
+	arrived = {}
+	tail = bytearray()
+	marker = re.compile(rb"@@(\d+)@@")
+
+	def on_data(data, t):
+		tail.extend(data)
+		for m in marker.finditer(tail):
+			arrived.setdefault(int(m.group(1)), t)
+		del tail[:max(0, len(tail) - 32)]
+
+	device = subprocess.Popen([args.device, "-headless", "-"], stdin=subprocess.PIPE,
+		stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+	link = start_link(args, ["sh"])
+	tap = Tap(link.stdout, device.stdin, on_data)
+	tap.start()
+
+	sent = {}
+	start = time.monotonic()
+	i = 0
+	while time.monotonic() - start < args.seconds:
+		# the typed line says "@@""7""@@", so only the output matches
+		line = "%s; printf '%%s\\n' \"@@\"\"%d\"\"@@\"\n" % (script[i % len(script)], i)
+		sent[i] = time.monotonic()
+		link.stdin.write(line.encode())
+		link.stdin.flush()
+		deadline = sent[i] + args.settle + len(line) * 10.0 / args.baud
+		while i not in arrived and time.monotonic() < deadline:
+			time.sleep(0.005)
+		i += 1
+	elapsed = time.monotonic() - start
+
+	link.stdin.write(b"exit\n")
+	link.stdin.close()
+	link_err = finish(link)
+	tap.join(5)
+	device_err = finish(device)
+
+	latencies = [(arrived[n] - sent[n]) * 1000 for n in sent if n in arrived]
+	dev = device_stats(device_err)
+	return {
+		"mode": "term",
+		"baud": args.baud,
+		"link_args": args.link,
+		"seconds": round(elapsed, 3),
+		"commands": len(sent),
+		"commands_completed": len(latencies),
+		"latency_ms": percentiles(latencies),
+		"frames": dev.get("frames"),
+		"frames_per_s": dev.get("frames_per_s"),
+		"link_bytes": tap.bytes,
+		"bytes_per_s": round(tap.bytes / elapsed, 1),
+		"bytes_per_updated_pixel": None,  # the terminal draws characters; only meaningful for xwd
+		"link": link_stats(link_err),
+		"device": dev,
+	}
+
+def main():
+	p = argparse.ArgumentParser(description="End to end benchmark through the emulated serial line")
+	p.add_argument("mode", choices=["xwd", "term", "fanout", "replay"])
+	p.add_argument("--baud", type=int, default=921600)
+	p.add_argument("--link", default="")
+	p.add_argument("--seconds", type=float, default=10)
+	p.add_argument("--settle", type=float, default=3, help="how long to wait for the last change to get through")
+	p.add_argument("--fps", type=float, default=10)
+	p.add_argument("--change", type=float, default=0.1)
+	p.add_argument("--credit", action="store_true")
+	p.add_argument("--window", type=int)
+	p.add_argument("--clients", default="1,2,4,8,16")
+	p.add_argument("--stalled", action="store_true")
+	p.add_argument("--script")
+	p.add_argument("--xvsmfbg", default=os.path.join(here, "xvsmfbg"))
+	p.add_argument("--tc-link", dest="tc_link", default=os.path.join(here, "emulator", "tc_link"))
+	p.add_argument("--device")
+	p.add_argument("-o", dest="output")
+	args = p.parse_args()
+
+	if not args.device:
+		if args.mode in ("xwd", "replay"):
+			args.device = os.path.join(here, "emulator", "tc_emulator_headless")
+		else:
+			args.device = os.path.join(here, "..", "Source Code", "host", "emulator-headless")
+
+	report = {"xwd": run_xwd, "term": run_term, "fanout": run_fanout, "replay": run_replay}[args.mode](args)
+	out = open(args.output, "w") if args.output else sys.stdout
+	json.dump(report, out, indent=2)
+	out.write("\n")
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,203 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+#include "xvsmfbg.h"
+#include "pipeline.h"
+#include "display.h"
+#include "capture.h"
+
+#include <algorithm>
+#include <fcntl.h>
+
+void queue_init( frame_queue& queue ) {
+	queue.head = queue.tail = 0;
+}
+
+// The producer's store of tail publishes the slot it just put in; the consumer's store of head
+// says that place in the ring is free again.
+bool queue_push( frame_queue& queue, frame_slot* slot ) {
+	unsigned tail = __atomic_load_n(&queue.tail, __ATOMIC_RELAXED);
+
+	if (tail - __atomic_load_n(&queue.head, __ATOMIC_ACQUIRE) == PIPELINE_SLOTS)
+		return false;
+	queue.slots[tail % PIPELINE_SLOTS] = slot;
+	__atomic_store_n(&queue.tail, tail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+frame_slot* queue_pop( frame_queue& queue ) {
+	unsigned head = __atomic_load_n(&queue.head, __ATOMIC_RELAXED);
+
+	if (__atomic_load_n(&queue.tail, __ATOMIC_ACQUIRE) == head)
+		return NULL;
+	frame_slot* slot = queue.slots[head % PIPELINE_SLOTS];
+	__atomic_store_n(&queue.head, head + 1, __ATOMIC_RELEASE);
+	return slot;
+}
+
+void counter_init( stage_counter& counter ) {
+	counter.count = 0;
+	counter.total = counter.most = 0;
+	counter.recent.resize(RECENT_SAMPLES);
+	counter.nrecent = 0;
+}
+
+void counter_add( stage_counter& counter, double seconds ) {
+	counter.count++;
+	counter.total += seconds;
+	if (seconds > counter.most)
+		counter.most = seconds;
+	if (counter.nrecent < RECENT_SAMPLES)
+		counter.recent[counter.nrecent++] = seconds;
+}
+
+// Shuffles the recent ones about, which is fine as they're only wanted for this.
+double counter_percentile( stage_counter& counter, double p ) {
+	if (!counter.nrecent)
+		return 0;
+	int nth = (int) (p / 100 * (counter.nrecent - 1) + 0.5);
+	nth_element(counter.recent.begin(), counter.recent.begin() + nth, counter.recent.begin() + counter.nrecent);
+	return counter.recent[nth];
+}
+
+void counter_roll( stage_counter& counter ) {
+	counter.nrecent = 0;
+}
+
+static void* capture_stage( void* arg ) {
+	pipeline_lane& lane = *(pipeline_lane*) arg;
+	pipeline& pipe = *lane.pipe;
+
+	while (!pipe.quit) {
+		// Never for longer than it takes to look, so it notices quit soon enough.
+		double t = now(), wake = t + pipe.settings->poll_interval;
+
+		for (size_t ii = 0; ii < lane.displays.size(); ii++) {
+			display& disp = *lane.displays[ii];
+			long frame = disp.frame;
+			double next = display_capture(disp, t, *pipe.settings);
+
+			if (disp.frame != frame)
+				sem_post(&lane.to_convert);
+			if (next < wake)
+				wake = next;
+		}
+
+		wake -= now();
+		if (wake > 0)
+			usleep((useconds_t) (wake * 1e6));
+	}
+	return NULL;
+}
+
+// Takes one slot that's waiting in from (there is one for every post of ready), trying the screens
+// in turn starting after the one it took last.
+static frame_slot* take( pipeline_lane& lane, sem_t& ready, frame_queue display::* from, size_t& next, display*& disp ) {
+	while (sem_wait(&ready) == -1 && errno == EINTR)
+		;
+	if (lane.pipe->quit)
+		return NULL;
+	for (size_t ii = 0; ii < lane.displays.size(); ii++) {
+		disp = lane.displays[(next + ii) % lane.displays.size()];
+		frame_slot* slot = queue_pop(disp->*from);
+		if (slot) {
+			next = (next + ii + 1) % lane.displays.size();
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+static void* convert_stage( void* arg ) {
+	pipeline_lane& lane = *(pipeline_lane*) arg;
+	size_t next = 0;
+	display* disp;
+	frame_slot* slot;
+
+	while (!lane.pipe->quit) {
+		if (!(slot = take(lane, lane.to_convert, &display::captured, next, disp)))
+			continue;
+		display_convert(*disp, *slot);
+		queue_push(disp->converted, slot);
+		sem_post(&lane.to_encode);
+	}
+	return NULL;
+}
+
+static void* encode_stage( void* arg ) {
+	pipeline_lane& lane = *(pipeline_lane*) arg;
+	size_t next = 0;
+	display* disp;
+	frame_slot* slot;
+
+	while (!lane.pipe->quit) {
+		if (!(slot = take(lane, lane.to_encode, &display::converted, next, disp)))
+			continue;
+		display_encode(*disp, *slot, *lane.pipe->settings);
+		queue_push(disp->encoded, slot);
+
+		// If the pipe's full, transmit has plenty to wake it already.
+		char c = 0;
+		if (write(lane.pipe->notify[1], &c, 1) == -1 && errno != EAGAIN)
+			perror("pipeline notify");
+	}
+	return NULL;
+}
+
+bool pipeline_start( pipeline& pipe, vector<display>& displays, int lanes, const display_settings& settings ) {
+	if (lanes <= 0)
+		lanes = sysconf(_SC_NPROCESSORS_ONLN);
+	if (lanes > (int) displays.size())
+		lanes = displays.size();
+	if (lanes <= 0)
+		lanes = 1;
+
+	if (::pipe(pipe.notify) == -1) {
+		perror("pipe");
+		return false;
+	}
+	fcntl(pipe.notify[0], F_SETFL, O_NONBLOCK);
+	fcntl(pipe.notify[1], F_SETFL, O_NONBLOCK);
+	pipe.settings = &settings;
+	pipe.quit = false;
+
+	pipe.lanes.resize(lanes);
+	for (size_t ii = 0; ii < displays.size(); ii++)
+		pipe.lanes[ii % lanes].displays.push_back(&displays[ii]);
+	for (int ii = 0; ii < lanes; ii++) {
+		pipeline_lane& lane = pipe.lanes[ii];
+		lane.pipe = &pipe;
+		sem_init(&lane.to_convert, 0, 0);
+		sem_init(&lane.to_encode, 0, 0);
+		pthread_create(&lane.capture, NULL, capture_stage, &lane);
+		pthread_create(&lane.convert, NULL, convert_stage, &lane);
+		pthread_create(&lane.encode, NULL, encode_stage, &lane);
+	}
+	return true;
+}
+
+void pipeline_stop( pipeline& pipe ) {
+	pipe.quit = true;
+	for (size_t ii = 0; ii < pipe.lanes.size(); ii++) {
+		pipeline_lane& lane = pipe.lanes[ii];
+		sem_post(&lane.to_convert);
+		sem_post(&lane.to_encode);
+		pthread_join(lane.capture, NULL);
+		pthread_join(lane.convert, NULL);
+		pthread_join(lane.encode, NULL);
+		sem_destroy(&lane.to_convert);
+		sem_destroy(&lane.to_encode);
+	}
+	close(pipe.notify[0]);
+	close(pipe.notify[1]);
+}
+
+void pipeline_drain( pipeline& pipe ) {
+	char junk[256];
+
+	while (read(pipe.notify[0], junk, sizeof(junk)) > 0)
+		;
+}
@@ -0,0 +1,110 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+// Getting frames from the screens to the outputs in stages, each on its own thread, so that none of
+// them waits on another: capture copies a screen out of shared memory when it changes, convert works
+// out the luminance, encode dithers and packs it into bits, and transmit (the main thread) hands the
+// newest frame to whichever outputs are ready for it.
+//
+// Each screen has PIPELINE_SLOTS frames' worth of buffers, allocated once, which go round and round
+// through queues between the stages.  Transmit keeps hold of the newest one it has; when a newer one
+// arrives, the old one goes back to capture, sent or not.  If capture finds no slot free it leaves the
+// screen marked as changed and tries again next time it looks.
+
+#ifndef _XVSMFBG_PIPELINE_
+#define _XVSMFBG_PIPELINE_
+
+#include "convert.h"
+#include "output.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <vector>
+
+#define PIPELINE_SLOTS 4   // a power of two
+
+struct frame_slot {
+	long frame;              // numbered from 1 as captured
+	unsigned char* screen;   // the XWD header and colormap, then as many rows as get sent
+	unsigned char lum[OUTPUT_WIDTH * OUTPUT_HEIGHT];
+	unsigned char bits[FRAME_BYTES];
+
+	// When it went into and came out of each stage
+	double looked;           // the look that saw the change
+	double captured;
+	double convert_start, converted;
+	double encode_start, encoded;
+	bool started;            // an output has been started on it
+};
+
+// One frame's trip to one output, when it's all been written.
+struct frame_times {
+	long frame;
+	double looked, captured, converted, encoded, started, written;
+};
+
+// A ring of slots going from one thread to exactly one other, without locks.
+// Each end only ever writes its own index.
+struct frame_queue {
+	frame_slot* slots[PIPELINE_SLOTS];
+	unsigned head;           // where the consumer takes the next one
+	unsigned tail;           // where the producer puts the next one
+};
+
+void queue_init( frame_queue& queue );
+
+// False if it's full.
+bool queue_push( frame_queue& queue, frame_slot* slot );
+
+// NULL if it's empty.
+frame_slot* queue_pop( frame_queue& queue );
+
+// Where a frame's time goes: how many went through a stage, the total and the longest, and the
+// first RECENT_SAMPLES since counter_roll for percentiles.
+#define RECENT_SAMPLES 1024
+
+struct stage_counter {
+	long count;
+	double total, most;
+	std::vector<float> recent;   // RECENT_SAMPLES of room, so adding never allocates
+	int nrecent;
+};
+
+void counter_init( stage_counter& counter );
+void counter_add( stage_counter& counter, double seconds );
+
+// The pth percentile of the recent ones, or 0 if there weren't any.
+double counter_percentile( stage_counter& counter, double p );
+void counter_roll( stage_counter& counter );
+
+struct display;
+struct display_settings;
+
+// The stage threads for some of the screens.  Screens are dealt out to the lanes in turn, so a
+// slow screen only holds up the others in its lane.
+struct pipeline_lane {
+	std::vector<display*> displays;
+	pthread_t capture, convert, encode;
+	sem_t to_convert, to_encode;     // one post for each slot pushed to that stage
+	struct pipeline* pipe;
+};
+
+struct pipeline {
+	std::vector<pipeline_lane> lanes;
+	const display_settings* settings;
+	int notify[2];                   // a byte comes down here whenever a frame is ready to transmit
+	volatile bool quit;
+};
+
+// Starts lanes lanes (0 for one per core, but no more than there are screens) on the displays.
+bool pipeline_start( pipeline& pipe, std::vector<display>& displays, int lanes, const display_settings& settings );
+
+void pipeline_stop( pipeline& pipe );
+
+// Throws away the notifications; poll pipe.notify[0] to hear about them.
+void pipeline_drain( pipeline& pipe );
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+#include "xvsmfbg.h"
+#include "record.h"
+#include "capture.h"
+
+bool record_open( recording& rec, const char* path ) {
+	rec.file = fopen(path, "wbe");
+	if (!rec.file) {
+		cerr << "Error opening " << path << " to record to: ";
+		perror(NULL);
+		return false;
+	}
+	if (fwrite(RECORD_MAGIC, 8, 1, rec.file) != 1) {
+		cerr << "Error writing to " << path << ": ";
+		perror(NULL);
+		record_close(rec);
+		return false;
+	}
+	rec.frames = 0;
+	rec.start = 0;
+	return true;
+}
+
+bool record_frame( recording& rec, double t, const unsigned char* frame, size_t size ) {
+	frame_record header;
+
+	if (!rec.file)
+		return false;
+	if (!rec.frames)
+		rec.start = t;
+	header.t = t - rec.start;
+	header.size = size;
+	if (fwrite(&header, sizeof(header), 1, rec.file) != 1 || fwrite(frame, size, 1, rec.file) != 1) {
+		cerr << "Error recording frame " << rec.frames + 1 << ", so stopped recording: ";
+		perror(NULL);
+		record_close(rec);
+		return false;
+	}
+	rec.frames++;
+	return true;
+}
+
+void record_close( recording& rec ) {
+	if (rec.file)
+		fclose(rec.file);
+	rec.file = NULL;
+}
+
+bool replay_open( recording& rec, const char* path, bool fast, unsigned char*& first, size_t& size ) {
+	char magic[8];
+	frame_record header;
+
+	rec.file = fopen(path, "rbe");
+	if (!rec.file) {
+		cerr << "Error opening " << path << " to replay: ";
+		perror(NULL);
+		return false;
+	}
+	if (fread(magic, 8, 1, rec.file) != 1 || memcmp(magic, RECORD_MAGIC, 8)) {
+		cerr << path << " isn't a recording." << endl;
+		record_close(rec);
+		return false;
+	}
+	if (fread(&header, sizeof(header), 1, rec.file) != 1 || !header.size) {
+		cerr << path << " has no frames in it." << endl;
+		record_close(rec);
+		return false;
+	}
+
+	size = header.size;
+	first = new unsigned char[size];
+	if (fread(first, size, 1, rec.file) != 1) {
+		cerr << path << " ends part way through its first frame." << endl;
+		delete[] first;
+		first = NULL;
+		record_close(rec);
+		return false;
+	}
+
+	// Back to the start for replay_frame.
+	fseek(rec.file, 8, SEEK_SET);
+	rec.frames = 0;
+	rec.first_t = header.t;
+	rec.fast = fast;
+	return true;
+}
+
+bool replay_frame( recording& rec, unsigned char* frame, size_t size, double& due ) {
+	frame_record header;
+
+	if (!rec.file || fread(&header, sizeof(header), 1, rec.file) != 1)
+		return false;
+	if (header.size != size) {
+		cerr << "Frame " << rec.frames + 1 << " of the recording is " << header.size << " bytes, not " << size
+		     << "; the screen can't change size part way through." << endl;
+		return false;
+	}
+	if (fread(frame, size, 1, rec.file) != 1) {
+		cerr << "The recording ends part way through frame " << rec.frames + 1 << "." << endl;
+		return false;
+	}
+
+	if (!rec.frames)
+		rec.start = now();
+	due = rec.fast ? 0 : rec.start + header.t - rec.first_t;
+	rec.frames++;
+	return true;
+}
@@ -0,0 +1,51 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+// Recordings of what xvsmfbg captured, so the same screens can go through conversion again later
+// without Xvfb or whatever was drawing on it.
+//
+// A recording is RECORD_MAGIC, then for every frame captured a frame_record and the frame itself:
+// the whole screen as Xvfb keeps it, XWD header, colormap and pixels.  Everything is in the byte
+// order of the machine that made it, like the XWD header.
+
+#ifndef _XVSMFBG_RECORD_
+#define _XVSMFBG_RECORD_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define RECORD_MAGIC "XVSMFBG\001"
+
+struct frame_record {
+	double t;                // seconds since the first frame was captured
+	uint64_t size;           // bytes of frame that follow
+};
+
+struct recording {
+	FILE* file;
+	double start;            // when the first frame was captured (or replayed)
+	long frames;
+	double first_t;          // replay: the first frame's t
+	bool fast;               // replay: as fast as it'll go, rather than as recorded
+};
+
+// Starts a recording.  Returns false, having said why, if it can't.
+bool record_open( recording& rec, const char* path );
+
+// Adds a frame captured at t.  Returns false, having said why, if it can't, and stops recording.
+bool record_frame( recording& rec, double t, const unsigned char* frame, size_t size );
+
+void record_close( recording& rec );
+
+// Opens a recording to replay, reading the first frame into a new[] buffer to find out what the
+// screen is like.  Returns false, having said why, if it can't.
+bool replay_open( recording& rec, const char* path, bool fast, unsigned char*& first, size_t& size );
+
+// Reads the next frame, which has to be size bytes, and says when it's due: right away if fast,
+// otherwise as long after the first as it was recorded.  Returns false at the end, or if it can't.
+bool replay_frame( recording& rec, unsigned char* frame, size_t size, double& due );
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+#include "xvsmfbg.h"
+#include "ring.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static size_t ring_size( int slots ) {
+	return sizeof(ring_header) + (size_t) (slots - 1) * sizeof(ring_slot);
+}
+
+bool ring_create( frame_ring& ring, const char* name, int slots ) {
+	ring.name = name;
+	ring.size = ring_size(slots);
+	ring.owner = true;
+
+	// A fresh one every time, so nobody's left reading one that's gone stale.
+	shm_unlink(name);
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd == -1) {
+		cerr << "Error making shared memory " << name << ": ";
+		perror(NULL);
+		return false;
+	}
+	if (ftruncate(fd, ring.size) == -1) {
+		cerr << "Error sizing shared memory " << name << ": ";
+		perror(NULL);
+		close(fd);
+		shm_unlink(name);
+		return false;
+	}
+	void* mem = mmap(NULL, ring.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		cerr << "Error mapping shared memory " << name << ": ";
+		perror(NULL);
+		shm_unlink(name);
+		return false;
+	}
+
+	// It comes zeroed, so every seq is 0 and latest says there's nothing yet.  Readers check the
+	// magic last, so fill that in last.
+	ring.header = (ring_header*) mem;
+	ring.header->version = RING_VERSION;
+	ring.header->slots = slots;
+	ring.header->frame_bytes = FRAME_BYTES;
+	ring.header->pid = getpid();
+	__atomic_store_n(&ring.header->magic, RING_MAGIC, __ATOMIC_RELEASE);
+	return true;
+}
+
+bool ring_attach( frame_ring& ring, const char* name ) {
+	struct stat st;
+
+	ring.name = name;
+	ring.owner = false;
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		cerr << "Error opening shared memory " << name << ": ";
+		perror(NULL);
+		return false;
+	}
+	if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(ring_header)) {
+		cerr << name << " is too small to be a ring of frames." << endl;
+		close(fd);
+		return false;
+	}
+	ring.size = st.st_size;
+	void* mem = mmap(NULL, ring.size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		cerr << "Error mapping shared memory " << name << ": ";
+		perror(NULL);
+		return false;
+	}
+
+	ring.header = (ring_header*) mem;
+	if (__atomic_load_n(&ring.header->magic, __ATOMIC_ACQUIRE) != RING_MAGIC || ring.header->version != RING_VERSION
+	    || ring.header->frame_bytes != FRAME_BYTES || ring.header->slots < 1 || ring_size(ring.header->slots) > ring.size) {
+		cerr << name << " isn't a ring of frames this understands." << endl;
+		ring_close(ring);
+		return false;
+	}
+	return true;
+}
+
+void ring_close( frame_ring& ring ) {
+	if (ring.header)
+		munmap(ring.header, ring.size);
+	ring.header = NULL;
+	if (ring.owner)
+		shm_unlink(ring.name.c_str());
+}
+
+// The seqlock's write side: mark the slot odd, fill it in, mark it done, then say it's the newest.
+// The fences keep the frame's bytes between the two marks as far as any reader can see.
+void ring_publish( frame_ring& ring, long frame, const unsigned char* bits, double t ) {
+	ring_header* header = ring.header;
+	ring_slot& slot = header->slot[frame % header->slots];
+
+	__atomic_store_n(&slot.seq, 2 * (uint64_t) frame - 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot.frame = frame;
+	slot.t = t;
+	memcpy(slot.bits, bits, FRAME_BYTES);
+	__atomic_store_n(&slot.seq, 2 * (uint64_t) frame, __ATOMIC_RELEASE);
+	__atomic_store_n(&header->latest, (uint64_t) frame, __ATOMIC_RELEASE);
+}
+
+const ring_slot* ring_latest( const frame_ring& ring, uint64_t after, uint64_t& frame ) {
+	const ring_header* header = ring.header;
+
+	frame = __atomic_load_n(&header->latest, __ATOMIC_ACQUIRE);
+	if (!frame || frame <= after)
+		return NULL;
+	const ring_slot* slot = &header->slot[frame % header->slots];
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != 2 * frame)
+		return NULL;  // already being overwritten; latest will have moved on
+	return slot;
+}
+
+bool ring_still_valid( const ring_slot* slot, uint64_t frame ) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == 2 * frame;
+}
+
+bool ring_writer_alive( const frame_ring& ring ) {
+	return kill(ring.header->pid, 0) == 0 || errno == EPERM;
+}
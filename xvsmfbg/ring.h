@@ -0,0 +1,71 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+// Frames in POSIX shared memory, for any number of programs on the same machine to read without
+// a pipe each: xvsmfbg writes each new frame into the next of a ring of slots, and readers look at
+// whichever is newest, straight out of the shared memory, whenever they like.
+//
+// There's one writer and it never waits for anyone.  A slot's seq is odd while it's being written
+// and twice the frame number once it's done, so a reader checks seq is what it expects, reads the
+// frame, and checks seq again: if it changed, the writer came round to that slot meanwhile and what
+// it read is no good.  With more than a couple of slots that only happens to a reader that's very
+// slow, and it can just go for the newest again.
+
+#ifndef _XVSMFBG_RING_
+#define _XVSMFBG_RING_
+
+#include "output.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define RING_MAGIC   0x58565247   // "XVRG"
+#define RING_VERSION 1
+
+struct ring_slot {
+	uint64_t seq;            // odd while being written, 2 * frame when it's done
+	uint64_t frame;
+	double t;                // when it was written, on CLOCK_MONOTONIC
+	unsigned char bits[FRAME_BYTES];
+};
+
+struct ring_header {
+	uint32_t magic, version;
+	uint32_t slots;
+	uint32_t frame_bytes;    // FRAME_BYTES, so a reader built differently can tell
+	int32_t pid;             // of the writer
+	uint32_t pad;
+	uint64_t latest;         // the newest frame done, or 0 for none yet
+	ring_slot slot[1];       // slots of them
+};
+
+struct frame_ring {
+	std::string name;
+	ring_header* header;
+	size_t size;
+	bool owner;              // we made it, so take it away again at the end
+};
+
+// Makes the ring (replacing any left over), for writing.  Returns false, having said why, if it can't.
+bool ring_create( frame_ring& ring, const char* name, int slots );
+
+// Opens someone else's ring for reading.  Returns false, having said why, if it can't.
+bool ring_attach( frame_ring& ring, const char* name );
+
+void ring_close( frame_ring& ring );
+
+void ring_publish( frame_ring& ring, long frame, const unsigned char* bits, double t );
+
+// The newest frame, read in place: returns the slot and sets frame to its number, or returns NULL
+// if there's nothing newer than after.  Once done with slot, ring_still_valid says whether it was
+// overwritten meanwhile, in which case whatever was read from it has to be thrown away.
+const ring_slot* ring_latest( const frame_ring& ring, uint64_t after, uint64_t& frame );
+bool ring_still_valid( const ring_slot* slot, uint64_t frame );
+
+// Whether the writer is still there.
+bool ring_writer_alive( const frame_ring& ring );
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+// ringread: reads frames out of the shared memory ring an "-out shm:/name" output makes.
+//
+//	make ringread && ./ringread /xvsmfbg | emulator/tc_emulator
+//
+// Writes each new frame to stdout as it appears, the same as xvsmfbg would to a file or pipe.
+// Frames that came and went between looks are skipped, not queued up; -count stops after that
+// many.  With -stats, says at the end how many it wrote, how many it skipped and how many it had
+// to throw away because xvsmfbg came round to the slot while it was being read.  Stops when
+// xvsmfbg does.
+
+#include "xvsmfbg.h"
+#include "ring.h"
+
+int main( int argc, char** argv ) {
+	frame_ring ring;
+	const char* name = NULL;
+	double poll_interval = 0.005;
+	long count = 0;
+	bool stats = false, failed = false;
+
+	for (int ii = 1; ii < argc; ii++) {
+		if (strcmp(argv[ii], "-poll") == 0 && ii + 1 < argc && atof(argv[ii + 1]) > 0) {
+			poll_interval = atof(argv[++ii]) / 1000;
+		} else if (strcmp(argv[ii], "-count") == 0 && ii + 1 < argc && atol(argv[ii + 1]) > 0) {
+			count = atol(argv[++ii]);
+		} else if (strcmp(argv[ii], "-stats") == 0) {
+			stats = true;
+		} else if (argv[ii][0] == '/' && !name) {
+			name = argv[ii];
+		} else {
+			name = NULL;
+			break;
+		}
+	}
+	if (!name) {
+		cerr << "Usage: " << argv[0] << " /name [-poll ms] [-count frames] [-stats]" << endl;
+		return 1;
+	}
+
+	// Might be started before xvsmfbg has made it.
+	for (int tries = 0; !ring_attach(ring, name); tries++) {
+		if (tries == 50)
+			return 1;
+		usleep(100000);
+	}
+
+	uint64_t last = 0;
+	long written = 0, skipped = 0, torn = 0;
+	unsigned char bits[FRAME_BYTES];
+	struct timespec wait;
+	wait.tv_sec = (time_t) poll_interval;
+	wait.tv_nsec = (long) ((poll_interval - wait.tv_sec) * 1e9);
+
+	while (!count || written < count) {
+		uint64_t frame;
+		const ring_slot* slot = ring_latest(ring, last, frame);
+		if (!slot) {
+			if (!ring_writer_alive(ring))
+				break;
+			nanosleep(&wait, NULL);
+			continue;
+		}
+
+		// Straight out of the ring into the kernel would mean a torn frame could get partly written
+		// before we knew, so it goes through bits.  One copy either way.
+		memcpy(bits, slot->bits, FRAME_BYTES);
+		if (!ring_still_valid(slot, frame)) {
+			torn++;
+			continue;
+		}
+		if (last)
+			skipped += frame - last - 1;
+		last = frame;
+
+		size_t done = 0;
+		while (done < FRAME_BYTES) {
+			ssize_t n = write(1, bits + done, FRAME_BYTES - done);
+			if (n == -1 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			done += n;
+		}
+		if (done < FRAME_BYTES) {
+			if (errno != EPIPE)
+				perror("Error writing frame");
+			failed = true;
+			break;
+		}
+		written++;
+	}
+
+	if (stats)
+		cerr << name << ": wrote " << written << " frames, skipped " << skipped << ", threw away " << torn
+		     << " read while being overwritten" << endl;
+	ring_close(ring);
+	return failed;
+}
@@ -0,0 +1,83 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+#include "xvsmfbg.h"
+#include "serial.h"
+
+#include <sys/ioctl.h>
+
+// Linux's termios2 takes the rate as a number (with BOTHER), so 921600 or 1000000 or whatever the
+// USB serial chip can do all work.  It can't be mixed with <termios.h>, which everywhere else has to make do with.
+#ifdef __linux__
+#include <asm/termbits.h>
+#define SERIAL_TERMIOS2
+typedef struct termios2 serial_termios;
+#else
+#include <termios.h>
+typedef struct termios serial_termios;
+#endif
+
+static bool get_attr( int fd, serial_termios& tio ) {
+#ifdef SERIAL_TERMIOS2
+	return ioctl(fd, TCGETS2, &tio) == 0;
+#else
+	return tcgetattr(fd, &tio) == 0;
+#endif
+}
+
+static bool set_attr( int fd, serial_termios& tio, int baud ) {
+#ifdef SERIAL_TERMIOS2
+	tio.c_cflag &= ~CBAUD;
+	tio.c_cflag |= BOTHER;
+	tio.c_ispeed = tio.c_ospeed = baud;
+	return ioctl(fd, TCSETS2, &tio) == 0;
+#else
+	speed_t speed;
+	switch (baud) {
+		case 9600:   speed = B9600; break;
+		case 19200:  speed = B19200; break;
+		case 38400:  speed = B38400; break;
+		case 57600:  speed = B57600; break;
+		case 115200: speed = B115200; break;
+		case 230400: speed = B230400; break;
+		default:
+			cerr << baud << " baud needs Linux; only the standard rates up to 230400 work here." << endl;
+			errno = EINVAL;
+			return false;
+	}
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	return tcsetattr(fd, TCSANOW, &tio) == 0;
+#endif
+}
+
+bool serial_setup( int fd, const char* path, int baud, bool rtscts ) {
+	serial_termios tio;
+
+	if (!get_attr(fd, tio)) {
+		cerr << path << " isn't a serial port: ";
+		perror(NULL);
+		return false;
+	}
+
+	// Raw: no line editing, no translating, no flow control characters, 8N1.
+	tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY);
+	tio.c_oflag &= ~OPOST;
+	tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+	tio.c_cflag &= ~(CSIZE | PARENB | CSTOPB | CRTSCTS);
+	tio.c_cflag |= CS8 | CREAD | CLOCAL;
+	if (rtscts)
+		tio.c_cflag |= CRTSCTS;
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+
+	if (!set_attr(fd, tio, baud)) {
+		cerr << "Can't set " << path << " to " << baud << " baud: ";
+		perror(NULL);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,16 @@
+/*
+ *   Written by Peter Schmidt-Nielsen
+ * Copyleft, 2010. All wrongs reserved.
+ *         (Public domain)
+ */
+
+// Talking to the thinner client's serial port directly, instead of through stream.py.
+
+#ifndef _XVSMFBG_SERIAL_
+#define _XVSMFBG_SERIAL_
+
+// Sets an open port raw, 8N1, at baud bits a second.  On Linux that can be any rate the driver can
+// do, not just the standard ones.  Returns false, having said why, if it isn't a serial port or can't.
+bool serial_setup( int fd, const char* path, int baud, bool rtscts );
+
+#endif
@@ -5,18 +5,15 @@
  */
 
 #include "xvsmfbg.h"
+#include "convert.h"
+#include "capture.h"
+#include "output.h"
+#include "display.h"
+#include "pipeline.h"
+#include "metrics.h"
 
-// This program is hardcoded to skip the xwd header in each frame, by skipping the first IMG_OFFSET bytes in the buffer.
-// This program also assumes that the input file uses 1 byte per pixel, and 480x240. (i.e., -screen 0 480x240x8 was passed to Xvfb)
-// TODO: Respect the header!!
-//
-// This format is unfortunately hard to Google for documentation about.
-// For epsilon more documentation of the format, see: http://www.martinreddy.net/gfx/2d/XWD.txt
-// Also, apt-get source x11-apps will get xwud, a program which uses this format.
-#define IMG_OFFSET (0xCA0)
-
-#define ASSUMED_WIDTH  480
-#define ASSUMED_HEIGHT 240
+#include <poll.h>
+#include <vector>
 
 volatile bool keep_running = true;
 
@@ -27,110 +24,202 @@ void stop_running(int sig) {
 	keep_running = false;
 }
 
-// Takes a portion of frame buffer, and writes it to the output stream after converting it to bit packed monochrome format.
-// Bitpacked monochrome currently defines the most siginificant bit to be the leading (or leftmost bit).
-int write_bits( unsigned char* img_buffer, int length ) {
-	static unsigned char* buffer = NULL;
-	static int cached_length = 0;
-
-	// Test if we already have a cached memory buffer suitable for staging the output.
-	// If not, create one and cache it.
-	if (buffer == NULL || cached_length != length) {
-		buffer = (unsigned char*) realloc(buffer, (length+7) / 8);
-		cached_length = length;
-	}
-
-	unsigned char* current_output_byte = buffer;
-
-	// Iterate through each byte of the input image.
-	for (int ii=0; ii < ((length+7) / 8); ii++) {
-		unsigned char build = 0;
-
-		// Build a byte of output, one bit at a time
-		for (int jj=0; jj<8; jj++) {
-			build <<= 1;
-
-			// Dithering mode: Take low order bit of color.
-			// I am actually shocked this worked at all.
-			// You'd expect low order bit to just be too noisy, right?
-			build ^= (*img_buffer) & 1;
-			img_buffer++;
-		}
+// Average and longest, in microseconds.
+static void print_counter( const char* name, const stage_counter& counter ) {
+	cerr << " " << name << " " << (counter.count ? (long) (counter.total * 1e6 / counter.count) : 0)
+	     << " us (" << (long) (counter.most * 1e6) << ")";
+}
 
-		// For safety, the last pixel of every line must be blanked.
-		// Note that ASSUMED_WIDTH/8 is the number of bytes per line.
-		if ( ((ii+1) % (ASSUMED_WIDTH/8)) == 0 ) {
-			build &= 0xfe;
+void print_stats( vector<display>& displays, const pipeline& pipe, double elapsed ) {
+	long frames = 0;
+
+	for (size_t ii = 0; ii < displays.size(); ii++) {
+		display& disp = displays[ii];
+		frames += disp.frame;
+		cerr << disp.name << ": looked " << disp.looks << " times ("
+		     << (disp.looks ? (long) (disp.look_seconds * 1e6 / disp.looks) : 0) << " us), captured " << disp.frame << " frames, "
+		     << disp.dropped << " dropped" << endl;
+		cerr << " ";
+		print_counter("capture", disp.capture_time);
+		print_counter("wait", disp.convert_wait);
+		print_counter("convert", disp.convert_time);
+		print_counter("wait", disp.encode_wait);
+		print_counter("encode", disp.encode_time);
+		print_counter("wait", disp.transmit_wait);
+		print_counter("write", disp.write_time);
+		print_counter("total", disp.total_time);
+		cerr << endl;
+
+		for (size_t jj = 0; jj < disp.outputs.size(); jj++) {
+			output& out = disp.outputs[jj];
+			cerr << "  " << out.name << ": sent " << out.frames << " frames, " << out.superseded << " superseded";
+			if (out.ring)
+				cerr << "; in shared memory";
+			else if (out.use_credit)
+				cerr << "; credit went missing " << out.credit.lost << " times";
+			else
+				cerr << "; link took " << (long) out.pacer.rate << " bytes/s";
+			if (out.dead)
+				cerr << "; gone";
+			else if (out.waiting)
+				cerr << "; nobody reading it";
+			cerr << endl;
 		}
-
-		*current_output_byte = build;
-		current_output_byte++;
 	}
-
-	//cerr << "Sending frame of size: " << ((length+7) / 8) << endl;
-
-	// Write the output to stdout, which is the current output stream.
-	return write(1, buffer, (length+7) / 8);
+	cerr << displays.size() << " displays, " << frames << " frames in " << (long) elapsed << " s; "
+	     << pipe.lanes.size() << " lanes" << endl;
 }
 
 int main(int argc, char** argv) {
 
-	// By default, run at at most 1.666 frames per second.
-	// This has been hand tuned to sync with the rate of sending frames 480x240 of 115200 bits over the serial port at 921600 baud.
-	// This sucks! TODO: Once flow control is implemented, simply call select(2) on the serial port until you can send another frame.
-	// TODO: Read this from a configuration file. 
-	long long usleep_duration = 600000;
-
-	// Start by parsing the string printed out by: Xvfb -shmem
-	// An example such string would be: "screen 0 shmid 2949151"
-	cerr << "Parsing Xvfb's output..." << endl;
-
-	string shmem_str;
-
-	string null;
-	cin >> null;      // Ignore "screen"
-	cin.ignore(1);    // Ignore " "
-	cin >> null;      // Ignore screen number
-	cin.ignore(1);    // Ignore " "
-	cin >> null;      // Ignore "shmid"
-	cin.ignore(1);    // Ignore " "
-	cin >> shmem_str; // Read in the crucial shared memory ID number.
-
-	cerr << "Connecting to shared memory ID: " << shmem_str << endl;
-
-	int shmid;
-
-	// Convert shmem_str to an integer, and store it in shmid.
-	stringstream ss;
-	ss << shmem_str;
-	ss >> shmid;
+	// Look at each screen this often, and send it whenever it has changed and an output can take it.
+	// Set refresh to send the screen every so often even when it hasn't changed, for a far end
+	// that might have missed something.
+	double poll_interval = 0.01;
+	double refresh = 0;
+
+	// The screens: -display, as many times as there are screens, or the one Xvfb tells us about on stdin.
+	// Any of them can be recorded, and a recording replayed in place of a screen; see record.h.
+	// Each goes through capture, convert and encode on threads of its own, in one of threads lanes,
+	// one per core by default (see pipeline.h).
+	// Every stats seconds, say how it's going.
+	// And every second, the same and more for programs to read; see metrics.h.
+	vector<const char*> display_args;
+	int threads = 0;
+	double stats = 0;
+	const char* metrics = NULL;
+
+	// Where each goes: -out, as many times as there are places, after the -display it's for, or stdout.
+	// These are the defaults for each one; see output.h.
+	// Without credit, how fast a link is gets worked out as we go; rate is just where the guessing
+	// starts (921600 baud, 10 bits a byte).
+	// With a fifo the far end sends credit back down (see capture.h), or "-" for the port itself,
+	// only send what it has room for.  window is how many rows it can take before it has to give
+	// any credit back.  Everything in the window is already on its way when a new frame starts, so
+	// keep it to what covers the round trip.
+	output_spec defaults;
+	defaults.baud = 921600;
+	defaults.rtscts = false;
+	defaults.window = 16;
+	defaults.rate = 92160;
+	defaults.fps = 0;
+	defaults.slots = 8;
+	vector<pair<int, const char*> > out_args;  // display, spec
+
+	int dither = DITHER_THRESHOLD;
+	double gamma = 1, contrast = 1;
+
+	for (int arg = 1; arg < argc; arg++) {
+		if (!strcmp(argv[arg], "-dither") && arg+1 < argc && find_dither(argv[arg+1]) >= 0)
+			dither = find_dither(argv[++arg]);
+		else if (!strcmp(argv[arg], "-gamma") && arg+1 < argc)
+			gamma = atof(argv[++arg]);
+		else if (!strcmp(argv[arg], "-contrast") && arg+1 < argc)
+			contrast = atof(argv[++arg]);
+		else if (!strcmp(argv[arg], "-poll") && arg+1 < argc && atof(argv[arg+1]) > 0)
+			poll_interval = atof(argv[++arg]) / 1000;
+		else if (!strcmp(argv[arg], "-rate") && arg+1 < argc && atof(argv[arg+1]) > 0)
+			defaults.rate = atof(argv[++arg]);
+		else if (!strcmp(argv[arg], "-refresh") && arg+1 < argc)
+			refresh = atof(argv[++arg]);
+		else if (!strcmp(argv[arg], "-credit") && arg+1 < argc)
+			defaults.credit = argv[++arg];
+		else if (!strcmp(argv[arg], "-window") && arg+1 < argc && atoi(argv[arg+1]) > 0)
+			defaults.window = atoi(argv[++arg]);
+		else if ((!strcmp(argv[arg], "-out") || !strcmp(argv[arg], "-serial")) && arg+1 < argc)
+			out_args.push_back(make_pair((int) display_args.size() - 1, argv[++arg]));
+		else if (!strcmp(argv[arg], "-baud") && arg+1 < argc && atoi(argv[arg+1]) > 0)
+			defaults.baud = atoi(argv[++arg]);
+		else if (!strcmp(argv[arg], "-rtscts"))
+			defaults.rtscts = true;
+		else if (!strcmp(argv[arg], "-fps") && arg+1 < argc && atof(argv[arg+1]) >= 0)
+			defaults.fps = atof(argv[++arg]);
+		else if (!strcmp(argv[arg], "-display") && arg+1 < argc)
+			display_args.push_back(argv[++arg]);
+		else if (!strcmp(argv[arg], "-threads") && arg+1 < argc && atoi(argv[arg+1]) > 0)
+			threads = atoi(argv[++arg]);
+		else if (!strcmp(argv[arg], "-stats") && arg+1 < argc)
+			stats = atof(argv[++arg]);
+		else if (!strcmp(argv[arg], "-metrics") && arg+1 < argc)
+			metrics = argv[++arg];
+		else {
+			cerr << "usage: " << argv[0] << " [-dither mode] [-gamma G] [-contrast C] [-poll ms] [-refresh s]" << endl
+			     << "       [-baud N] [-rtscts] [-credit fifo|-] [-window rows] [-rate bytes/s] [-fps N]" << endl
+			     << "       [-threads N] [-stats s] [-metrics -|socket[,frames]]" << endl
+			     << "       [-display -|shmid=N|:N|replay=file[,fast][,fps=N][,screen=WxHxD][,crop=WxH+X+Y][,scale][,record=file]" << endl
+			     << "        [-out path|shm:/name[,baud=N][,rtscts][,credit=fifo|-][,window=rows][,rate=bytes/s][,fps=N][,slots=N]]...]..." << endl
+			     << "       [< Xvfb's output]" << endl;
+			cerr << "modes:";
+			for (int ii = 0; ii < NUM_DITHER_MODES; ii++)
+				cerr << " " << dither_names[ii];
+			cerr << endl;
+			return 1;
+		}
+	}
 
-	// Connect to the shared memory object for reading, attaching anywhere.
-	char* buffer = (char*) shmat(shmid, NULL, SHM_RDONLY);
+	// Outputs before any -display are for the one on stdin.
+	vector<display_spec> specs;
+	bool any_before = false;
+	for (size_t ii = 0; ii < out_args.size(); ii++)
+		any_before = any_before || out_args[ii].first < 0;
+	if (display_args.empty() || any_before) {
+		specs.resize(1);
+		parse_display("-", specs[0]);
+	}
+	int first = specs.size();
+	for (size_t ii = 0; ii < display_args.size(); ii++) {
+		specs.resize(specs.size() + 1);
+		if (!parse_display(display_args[ii], specs.back()))
+			return 1;
+	}
+	for (size_t ii = 0; ii < out_args.size(); ii++) {
+		display_spec& spec = specs[out_args[ii].first < 0 ? 0 : first + out_args[ii].first];
+		spec.outputs.resize(spec.outputs.size() + 1);
+		if (!parse_output(out_args[ii].second, defaults, spec.outputs.back()))
+			return 1;
+	}
+	for (size_t ii = 0; ii < specs.size(); ii++) {
+		if (!specs[ii].outputs.empty())
+			continue;
+		if (specs.size() > 1) {
+			cerr << "Every display needs an -out when there's more than one." << endl;
+			return 1;
+		}
+		specs[ii].outputs.resize(1);
+		parse_output("-", defaults, specs[ii].outputs[0]);
+	}
 
-	if (buffer == (void*) -1) {
-		cerr << "Error attaching to shared memory object: ";
-		perror(NULL);
-		return 1;
+	// An output going away shows up as EPIPE, for that output alone.
+	signal(SIGPIPE, SIG_IGN);
+
+	build_tone_table(gamma, contrast);
+	display_settings settings;
+	settings.dither = dither;
+	settings.pack = pick_pack_kernel();
+	settings.poll_interval = poll_interval;
+	settings.refresh = refresh;
+
+	vector<display> displays(specs.size());
+	for (size_t ii = 0; ii < specs.size(); ii++) {
+		if (!display_open(displays[ii], specs[ii])) {
+			for (size_t jj = 0; jj <= ii; jj++)
+				display_close(displays[jj]);
+			return 4;
+		}
 	}
 
 	// Print a nice divider to indicate success
 	cerr << "=====" << endl;
-
-	// Retrieve some info about a given shared memory buffer, then spit it out.
-	struct shmid_ds shmbuffer;
-	int ctlrv = shmctl(shmid, IPC_STAT, &shmbuffer); 
-
-	if (ctlrv == -1) {
-		cerr << "Error retrieving information about the shared memory segment: ";
-		perror(NULL);
-		return 2;
+	cerr << "Packing with:       " << settings.pack->name << endl;
+	cerr << "Dithering:          " << dither_names[dither] << ", gamma " << gamma << ", contrast " << contrast << endl;
+
+	pipeline pipe;
+	if (!pipeline_start(pipe, displays, threads, settings)) {
+		for (size_t ii = 0; ii < displays.size(); ii++)
+			display_close(displays[ii]);
+		return 4;
 	}
-
-	cerr << "Attached at:        " << buffer << endl;
-	cerr << "Buffer Size:        " << shmbuffer.shm_segsz << endl;
-	cerr << "Buffer Attach Time: " << ctime(&shmbuffer.shm_atime);
-	cerr << "Buffer Change Time: " << ctime(&shmbuffer.shm_ctime);
+	cerr << "Lanes:              " << pipe.lanes.size() << endl;
 
 	// Register a handler for Ctrl+C
 	struct sigaction sigIntHandler;
@@ -141,28 +230,99 @@ int main(int argc, char** argv) {
 
 	sigaction(SIGINT, &sigIntHandler, NULL);
 
+	vector<struct pollfd> fds;
+	double start = now(), next_stats = start + stats;
+
+	metrics_sink sink;
+	if (metrics && !metrics_open(sink, metrics, start)) {
+		pipeline_stop(pipe);
+		for (size_t ii = 0; ii < displays.size(); ii++)
+			display_close(displays[ii]);
+		return 1;
+	}
+	double next_metrics = start + 1;
+
 	// Copy over until a Ctrl+C interrupt is recieved
 	while (keep_running) {
-		// Do something with the frame that lives from buffer[0] to buffer[shmbuffer.shm_segsz].
-		// In this case, we:
-
-		// Convert the frame to bitpacked monochrome. (most significant bit = leftmost pixel in byte)
-		// This function call has the side effect of writing the data to stdout.
-		write_bits( (unsigned char*) buffer + IMG_OFFSET, shmbuffer.shm_segsz - IMG_OFFSET );
+		double t = now();
+		bool live = false, more = false, finished = true;
+
+		pipeline_drain(pipe);
+		fds.resize(1);
+		fds[0].fd = pipe.notify[0];
+		fds[0].events = POLLIN;
+
+		// Don't start an output on a frame until its link can take it, or frames just pile up on the
+		// way getting older.  By then there may be a newer one, which is the one it gets.
+		for (size_t ii = 0; ii < displays.size(); ii++) {
+			display& disp = displays[ii];
+			display_receive(disp);
+			frame_slot* slot = disp.current;
+
+			for (size_t jj = 0; jj < disp.outputs.size(); jj++) {
+				output& out = disp.outputs[jj];
+				output_update(out, t);
+				live = live || !out.dead;
+				frame_times& times = disp.sending[jj];
+				if (slot && out.frame != slot->frame && output_ready(out, t, poll_interval)) {
+					if (!slot->started)
+						counter_add(disp.transmit_wait, t - slot->encoded);
+					slot->started = true;
+					output_start(out, slot->frame, slot->bits, t);
+
+					times.frame = slot->frame;
+					times.looked = slot->looked;
+					times.captured = slot->captured;
+					times.converted = slot->converted;
+					times.encoded = slot->encoded;
+					times.started = t;
+					times.written = 0;
+				}
+
+				// Send as much as each output will take without waiting.
+				output_send(out);
+				if (out.written && !times.written && times.frame == out.frame) {
+					times.written = out.written;
+					counter_add(disp.write_time, times.written - times.started);
+					counter_add(disp.total_time, times.written - times.looked);
+					if (metrics)
+						metrics_frame(sink, disp, out.name, times);
+				}
+				more = more || output_busy(out);
+
+				struct pollfd pfds[2];
+				int n = output_pollfds(out, pfds);
+				fds.insert(fds.end(), pfds, pfds + n);
+			}
+			finished = finished && display_finished(disp);
+		}
+		if (!live || finished)
+			break;
+
+		if (metrics && t >= next_metrics) {
+			metrics_rollup(sink, displays, settings, t);
+			next_metrics += 1;
+			if (next_metrics < t)
+				next_metrics = t + 1;
+		}
+		if (stats > 0 && t >= next_stats) {
+			print_stats(displays, pipe, t - start);
+			next_stats = t + stats;
+		}
 
-		// Don't flood our output, sleep for a period.
-		// Note: usleep anyway even if the period is zero!
-		// Yielding to the OS between big writes is a generally good idea.
-		usleep( usleep_duration );
+		// Wait for a new frame, for an output to be able to take more or for credit to come back, or
+		// long enough for a link to have moved on.
+		poll(&fds[0], fds.size(), more ? 0 : (int) (poll_interval * 1000 + 0.999));
 	}
 
-	// Finally, detatch from the buffer.
-	if (shmdt(buffer) == -1) {
-		cerr << "Error detatching from shared memory object: ";
-		perror(NULL);
-		return 3;
+	pipeline_stop(pipe);
+	if (metrics) {
+		metrics_rollup(sink, displays, settings, now());
+		metrics_close(sink);
 	}
+	print_stats(displays, pipe, now() - start);
+	for (size_t ii = 0; ii < displays.size(); ii++)
+		display_close(displays[ii]);
 
 	return 0;
 }
-
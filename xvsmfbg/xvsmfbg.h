@@ -18,6 +18,7 @@ using namespace std;
 #include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <sys/types.h>
 #include <sys/ipc.h>